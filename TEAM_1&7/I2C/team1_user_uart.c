@@ -15,6 +15,7 @@
 #include <termios.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
 
 #define UART_DEVICE "/dev/serial0" // Default UART device path
 #define I2C_DEVICE "/dev/lcd_i2c"  // I2C device path (LCD display)
@@ -55,15 +56,19 @@ int main() {
     printf("Sent: %s", tx_buffer);  // Print the sent data
 
     // Step 4: Read data from UART response (loop until a newline character is received)
-    usleep(100000); // Introduce a small delay to allow data to loop back
     int count = 0;  // Counter for number of bytes read
-    while (1) {
-        bytes_read = read(uart_fd, rx_buffer + count, 1); // Read one byte at a time
-        if (bytes_read > 0) {
-            count += bytes_read;  // Increment count for each byte read
+    struct pollfd pfd = { .fd = uart_fd, .events = POLLIN }; // Wait for UART data instead of spinning
+    while (count < (int)sizeof(rx_buffer)) {
+        if (poll(&pfd, 1, -1) < 0) { // Sleep until the UART has data to read
+            perror("Failed to poll UART");
+            close(uart_fd);
+            return 1;
         }
-        if (rx_buffer[count - 1] == '\0') { // Break loop when newline character is received
-            break;
+        bytes_read = read(uart_fd, rx_buffer + count, sizeof(rx_buffer) - count); // Read everything buffered
+        if (bytes_read > 0) {
+            count += bytes_read;  // Increment count for each chunk read
+            if (rx_buffer[count - 1] == '\0') // Break loop when the terminating null byte is received
+                break;
         }
     }
 
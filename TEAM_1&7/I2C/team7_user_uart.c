@@ -13,6 +13,7 @@
 #include <string.h>     // Include string handling functions (strcmp, strlen, etc.)
 #include <errno.h>      // Include error handling (perror)
 #include <stdlib.h>     // Include standard library functions (exit, malloc, etc.)
+#include <poll.h>       // Include poll() to sleep until the UART has data
 
 // Define device paths for UART and I2C
 #define UART_DEVICE    "/dev/serial0"  // Default UART device (e.g., Raspberry Pi UART port)
@@ -35,6 +36,12 @@ int main()
     
     // Declare a counter to keep track of the number of bytes read from UART
     int count = 0;
+
+    // Declare a pointer to the newline that ends the command
+    char *newline = NULL;
+
+    // Declare the poll descriptor used to wait for UART data
+    struct pollfd pfd;
     
     // Declare variables to store raw data from the I2C device (e.g., sensor values)
     int x, y, z;
@@ -73,25 +80,38 @@ int main()
     // Apply the updated UART configuration settings
     tcsetattr(uart_fd, TCSANOW, &options);
 
+    // Wait for UART input with poll() instead of spinning on the non-blocking descriptor
+    pfd.fd = uart_fd;
+    pfd.events = POLLIN;
+
     // Start reading data from UART until newline character is encountered
-    while(1)
+    while (newline == NULL && count < (int)sizeof(rx_buffer) - 1)
     {
-        // Read one byte at a time from the UART into the reception buffer
-        bytes_read = read(uart_fd, rx_buffer + count, 1);  
-        
-        // If a byte is successfully read, increment the count
+        // Sleep until the UART has data to read
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            perror("Failed to poll UART");  // Print error message if polling fails
+            close(uart_fd);   // Close UART device
+            close(i2c_fd);    // Close I2C device
+            return 1;         // Exit the program with an error code
+        }
+
+        // Read everything that is buffered, not just one byte
+        bytes_read = read(uart_fd, rx_buffer + count, sizeof(rx_buffer) - 1 - count);
+
+        // If bytes were successfully read, increment the count
         if (bytes_read > 0)
         {
             count += bytes_read;  // Increment byte count
+            newline = memchr(rx_buffer, '\n', count);  // Check if a newline character is encountered
         }
-
-        // Check if a newline character is encountered
-        if (rx_buffer[count - 1] == '\n')  
-            break;  // Exit the loop when newline is found
     }
 
     // Null terminate the string by replacing the newline character with null byte
-    rx_buffer[count - 1] = 0;
+    if (newline != NULL)
+        *newline = 0;
+    else
+        rx_buffer[count] = 0;
 
     // Print the complete string received from UART
     printf("\nComplete string is %s\n", rx_buffer);
@@ -0,0 +1,25 @@
+/*
+ * ioctl interface of the bit-bang SPI master (spi_tx_driver.c) on top of spidev's
+ * SPI_IOC_* requests. Shared between the kernel module and the user-space programs.
+ */
+
+#ifndef SPI_BB_IOCTL_H
+#define SPI_BB_IOCTL_H
+
+#include <linux/ioctl.h>
+
+#define SPI_BB_IOC_MAGIC 'b'
+
+/*
+ * Exclusive bus ownership for latency-critical sequences of several messages. After
+ * SPI_BB_IOC_BUS_LOCK returns, the driver runs only this file's writes and SPI_IOC_MESSAGE
+ * batches, and it holds the SPI core's bus lock so that no other SPI client (on any
+ * chip-select) gets a message in between. Other files' writes stay queued until
+ * SPI_BB_IOC_BUS_UNLOCK, or until the owning file is closed. BUS_LOCK waits while
+ * another file owns the bus; with O_NONBLOCK it fails with EAGAIN instead.
+ * Mode and speed changes (SPI_IOC_WR_*) are refused with EBUSY while the bus is held.
+ */
+#define SPI_BB_IOC_BUS_LOCK   _IO(SPI_BB_IOC_MAGIC, 1)
+#define SPI_BB_IOC_BUS_UNLOCK _IO(SPI_BB_IOC_MAGIC, 2)
+
+#endif
@@ -3,9 +3,10 @@
  * 2. Set MOSI, SCK, and CS pins as input, and MISO, LED pins as output.
  * 3. Register a character device to allow user-space interaction.
  * 4. Wait for the master to initiate SPI communication by pulling CS low.
- * 5. On each clock cycle (SCK), read the bit from MOSI and shift it into a byte.
- * 6. Simultaneously, set the bit on the MISO line to send data back to the master.
- * 7. Once a full byte is received, store it in a buffer.
+ * 5. On each clock cycle (SCK), read the bit from MOSI and shift it into a word, on the edge
+ *    the SPI mode (module parameter mode, 0-3) samples on, MSB or LSB first (lsb_first).
+ * 6. Simultaneously, set the bit of tx_buffer on the MISO line on the edge where data changes.
+ * 7. Once a full word (bits_per_word, 4-32 bits) is received, store it in a buffer.
  * 8. When the user reads from the device, provide the received data to user-space.
  * 9. Control an LED based on the received data (turn it on/off).
  * 10. Clean up resources (GPIO pins and character device) during module removal.
@@ -25,16 +26,116 @@
 #define GPIO_CS   529     // GPIO pin for CS (Chip Select) (input)
 #define GPIO_LED  530     // GPIO pin for LED (output)
 
+// Frame format, must match the master's
+static int mode;                     // SPI mode 0-3 (bit 1 = CPOL, bit 0 = CPHA)
+module_param(mode, int, 0444);
+MODULE_PARM_DESC(mode, "SPI mode 0-3 (CPOL/CPHA)");
+static bool lsb_first;               // Least significant bit first
+module_param(lsb_first, bool, 0444);
+MODULE_PARM_DESC(lsb_first, "Shift words LSB first");
+static unsigned int bits_per_word = 8; // Word size in bits
+module_param(bits_per_word, uint, 0444);
+MODULE_PARM_DESC(bits_per_word, "Word size, 4 to 32 bits (stored in 1, 2 or 4 bytes)");
+
 // Global variables to store received and transmitted data
 static int major_number;                // For storing major number of character device
-static char rx_buffer[20];              // Buffer for receiving data (20 bytes)
-static char tx_buffer[20] = "HELLOMASTER";  // Buffer for transmitting data (initial message)
+static char rx_buffer[20] __aligned(4); // Buffer for receiving data (20 bytes)
+static char tx_buffer[20] __aligned(4) = "HELLOMASTER";  // Buffer for transmitting data (initial message)
+
+// Wait for SCK to reach the given level; false if the master released CS first
+static __always_inline bool spi_wait_sck(int level)
+{
+    while (gpio_get_value(GPIO_SCK) != level) {
+        if (gpio_get_value(GPIO_CS) == 1)
+            return false;
+        udelay(4);  // Delay to sync with clock
+    }
+    return true;
+}
+
+// Exchange one word with the master. Inlined into one function per mode and bit order, so
+// the per-bit loop carries no mode tests.
+static __always_inline int spi_xfer_bits(u32 tx, u8 bits, u32 *rx, const int cpol, const int cpha, const int lsb)
+{
+    u32 word = 0;
+    int i;
+
+    for (i = 0; i < bits; i++) {
+        int shift = lsb ? i : bits - 1 - i;  // Position of the bit going out and coming in
+
+        // CPHA=1: data changes on the leading edge; CPHA=0: it is set up before it
+        if (cpha && !spi_wait_sck(!cpol))
+            return -EIO;
+        gpio_set_value(GPIO_MISO, (tx >> shift) & 0x01);  // Set MISO pin to send bit
+
+        // Read data from MOSI pin on the sampling edge
+        if (!spi_wait_sck(cpha ? cpol : !cpol))
+            return -EIO;
+        word |= (u32)!!gpio_get_value(GPIO_MOSI) << shift;  // Shift and add bit
+
+        // CPHA=0: wait for the trailing edge before the next bit goes out
+        if (!cpha && !spi_wait_sck(cpol))
+            return -EIO;
+    }
+
+    *rx = word;
+    return 0;
+}
+
+#define SPI_XFER_WORD(name, cpol, cpha, lsb)                      \
+static int name(u32 tx, u8 bits, u32 *rx)                         \
+{                                                                 \
+    return spi_xfer_bits(tx, bits, rx, cpol, cpha, lsb);          \
+}
+
+SPI_XFER_WORD(spi_xfer_mode0, 0, 0, 0)
+SPI_XFER_WORD(spi_xfer_mode1, 0, 1, 0)
+SPI_XFER_WORD(spi_xfer_mode2, 1, 0, 0)
+SPI_XFER_WORD(spi_xfer_mode3, 1, 1, 0)
+SPI_XFER_WORD(spi_xfer_mode0_lsb, 0, 0, 1)
+SPI_XFER_WORD(spi_xfer_mode1_lsb, 0, 1, 1)
+SPI_XFER_WORD(spi_xfer_mode2_lsb, 1, 0, 1)
+SPI_XFER_WORD(spi_xfer_mode3_lsb, 1, 1, 1)
+
+// Word loops indexed by bit order and SPI mode
+static int (* const spi_xfer_words[2][4])(u32 tx, u8 bits, u32 *rx) = {
+    { spi_xfer_mode0, spi_xfer_mode1, spi_xfer_mode2, spi_xfer_mode3 },
+    { spi_xfer_mode0_lsb, spi_xfer_mode1_lsb, spi_xfer_mode2_lsb, spi_xfer_mode3_lsb },
+};
+
+static int (*spi_xfer_word)(u32 tx, u8 bits, u32 *rx);  // Picked at load time
+
+// Words occupy 1, 2 or 4 bytes of the buffers, like with spidev
+static unsigned int spi_word_bytes(void)
+{
+    return bits_per_word <= 8 ? 1 : bits_per_word <= 16 ? 2 : 4;
+}
+
+static u32 spi_get_word(const char *p, unsigned int bytes)
+{
+    if (bytes == 1)
+        return *(const u8 *)p;
+    if (bytes == 2)
+        return *(const u16 *)p;
+    return *(const u32 *)p;
+}
+
+static void spi_put_word(char *p, unsigned int bytes, u32 word)
+{
+    if (bytes == 1)
+        *(u8 *)p = word;
+    else if (bytes == 2)
+        *(u16 *)p = word;
+    else
+        *(u32 *)p = word;
+}
 
 // Function to receive data from SPI (bit-banging)
 static void spi_slave_receive(void)
 {
-    int byte_idx = 0, bit_idx;           // Indices to track byte and bit positions
-    char received_byte = 0;              // Buffer for received byte
+    unsigned int bytes = spi_word_bytes();
+    int byte_idx = 0;                    // Index of the current word in the buffers
+    u32 word;
 
     // Wait for CS to be pulled low (indicates start of communication)
     while (gpio_get_value(GPIO_CS) == 1) {
@@ -43,40 +144,19 @@ static void spi_slave_receive(void)
 
     pr_info("SPI Slave Started\n");       // Log that SPI slave communication has started
 
-    // Loop through receiving each byte while CS is low
-    while (gpio_get_value(GPIO_CS) == 0 && byte_idx < sizeof(rx_buffer)) {
-        received_byte = 0;               // Reset received byte
-        char byte_send = tx_buffer[byte_idx];  // Get the byte to be sent on MISO
-        
-        // Loop through each bit in the byte (7 bits, MSB first)
-        for (bit_idx = 7; bit_idx >= 0; bit_idx--) {
-            // Wait for SCK to go high (rising edge) to read data
-            while (gpio_get_value(GPIO_SCK) == 0) {
-                udelay(4);  // Delay to sync with clock
-            }
-
-            // Read data from MOSI pin (bit-by-bit)
-            int mosi_bit = gpio_get_value(GPIO_MOSI);
-            received_byte = (received_byte << 1) | mosi_bit;  // Shift and add bit
-
-            // Set MISO pin with the received bit to send back to master
-            int miso_bit = mosi_bit;  // Slave sends same bit back (in this case)
-            gpio_set_value(GPIO_MISO, miso_bit);  // Set MISO pin to send bit
-
-            // Wait for SCK to go low (falling edge) before moving to next bit
-            while (gpio_get_value(GPIO_SCK) == 1) {
-                udelay(4);  // Delay to sync with clock
-            }
-        }
-
-        // Store the received byte in the buffer and log it
-        rx_buffer[byte_idx] = received_byte;
-        pr_info("SPI Slave Received Byte: 0x%02x\n", received_byte);
-        pr_info("SPI Slave transferred Byte: 0x%02x\n", byte_send);
-        byte_idx++;  // Move to the next byte
+    // Loop through receiving each word while CS is low
+    while (gpio_get_value(GPIO_CS) == 0 && byte_idx + bytes <= sizeof(rx_buffer)) {
+        if (spi_xfer_word(spi_get_word(tx_buffer + byte_idx, bytes), bits_per_word, &word))
+            break;  // CS was released in the middle of a word
+
+        // Store the received word in the buffer and log it
+        spi_put_word(rx_buffer + byte_idx, bytes, word);
+        pr_info("SPI Slave Received Word: 0x%0*x\n", bytes * 2, word);
+        pr_info("SPI Slave transferred Word: 0x%0*x\n", bytes * 2, spi_get_word(tx_buffer + byte_idx, bytes));
+        byte_idx += bytes;  // Move to the next word
     }
 
-    pr_info("SPI Slave Received Data: %s\n", rx_buffer);  // Log the full received data
+    pr_info("SPI Slave Received Data: %.*s\n", (int)sizeof(rx_buffer), rx_buffer);  // Log the full received data
 }
 
 // Function to read from the device (called when user-space reads data)
@@ -114,6 +194,13 @@ static int __init spi_slave_init(void)
 {
     pr_info("Initializing SPI Slave (Bit-banging)\n");
 
+    // Check the frame format and pick the word loop for it
+    if (mode < 0 || mode > 3 || bits_per_word < 4 || bits_per_word > 32) {
+        pr_err("Unsupported SPI mode %d / %u bits per word\n", mode, bits_per_word);
+        return -EINVAL;
+    }
+    spi_xfer_word = spi_xfer_words[lsb_first][mode];
+
     // Request GPIOs for MOSI, MISO, SCK, CS, and LED pins
     if (gpio_request(GPIO_MOSI, "MOSI") ||
         gpio_request(GPIO_MISO, "MISO") ||
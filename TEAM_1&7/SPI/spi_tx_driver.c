@@ -4,45 +4,123 @@
     - MOSI = GPIO pin 535
     - MISO = GPIO pin 536
     - SCK = GPIO pin 537
-    - CS  = GPIO pin 529
+    - CS  = GPIO pin 529, or one GPIO per slave from the cs_gpios list (up to 8 chip-selects)
+    - IO2, IO3 = optional extra data lanes for quad I/O (module parameters io2_gpio, io3_gpio)
 
   Define Buffers:
-    - tx_buffer = "Hello SPI Slave!" (Data to send to slave)
-    - rx_buffer = empty buffer to store received data
+    - Every write becomes a job holding the bytes to send and room for the bytes received
+    - Submission queue: jobs of all open files, at most queue_depth, oldest first
+    - Completion queue: one per open file, the finished jobs of that file, oldest first
 
   Define File Operations:
-    - spi_write: Write data from user-space to tx_buffer
-    - spi_read: Read data from rx_buffer to user-space
+    - Minor number N of the character device talks to chip-select N
+    - spi_open/spi_release: Create/drop the completion queue of an open file
+    - spi_write: Queue the written data as a job and return without waiting for the wire
+    - spi_read: Read the received data of the oldest finished job of this file
+    - spi_poll: Readable when a job has finished, writable when the submission queue has room
+    - spi_ioctl: SPI_IOC_MESSAGE(N) as with spidev, a whole batch of transfers in one call;
+      SPI_IOC_RD/WR_MODE(32), _LSB_FIRST, _BITS_PER_WORD and _MAX_SPEED_HZ for the
+      chip-select's settings; SPI_BB_IOC_BUS_LOCK/UNLOCK (spi_bb_ioctl.h) for exclusive use
+      of the bus
 
   Define SPI Master Data Transfer:
-    - For each byte in tx_buffer:
-        - Set CS (Chip Select) to low (start communication)
-        - For each bit in the byte (MSB first):
-            - Set MOSI (Master Out Slave In) pin to current bit of the byte
-            - Read the bit from MISO (Master In Slave Out) pin
-            - Shift received bit into the received byte
-            - Toggle the SCK (Serial Clock) pin (High to Low)
-        - Store received byte in rx_buffer
-        - Set CS to high (end communication)
+    - The bit-banged lines are registered as an spi_master through spi-bitbang, so any SPI
+      device driver (spidev, sensors, flash) can use them like a hardware controller
+    - spi-bitbang calls txrx_word for each word, picked by the device's SPI mode:
+        - One inner loop per mode (CPOL/CPHA 0-3) and pin backend, each compiled with the
+          clock polarity, phase and backend as constants, so no such test is left in the
+          per-bit path
+        - Backends: gpiolib (any GPIO controller, e.g. gpio-sim) or, on BCM2835-family
+          chips, the GPSET/GPCLR/GPLEV registers directly; an SCK edge and a MOSI change
+          on the same bank go out in one register write
+        - At load time the bit time of each backend is measured without delays and the
+          resulting maximum SCK rate is logged and shown in debugfs
+        - SCK follows each transfer's speed_hz (else the device's max_speed_hz): the half
+          period spi-bitbang derives from it is shortened by the measured loop overhead and
+          busy-waited with ndelay; the controller's maximum is the measured rate
+        - Every transfer is timed, and debugfs spi_master_bitbang/clock shows the requested
+          and achieved SCK rate of the last one
+        - Words of 4 to 32 bits, MSB or LSB first (SPI_LSB_FIRST picks one of two loops
+          per word, never per bit)
+        - For each bit in the word:
+            - Set MOSI (Master Out Slave In) pin to current bit of the word
+            - Toggle the SCK (Serial Clock) pin, sampling MISO on the edge the mode demands
+            - Shift received bit into the received word
+    - Dual and quad I/O (transfers with tx_nbits/rx_nbits of 2 or 4): MOSI is IO0, MISO IO1,
+      plus IO2 and IO3 for quad:
+        - Half duplex, 8-bit words, MSB first; each clock moves nbits bits, lane 0 carrying
+          the lowest of them
+        - The lanes are turned around for the transfer (outputs to send, inputs to receive)
+          and back to single SPI afterwards (MOSI and IO2/IO3 driven, IO2/IO3 high)
+        - On the register backend, when SCK and all lanes share a bank, every clock edge sets
+          all lanes and SCK with one GPSET and one GPCLR write and samples them with one
+          GPLEV read
+    - chipselect drives the CS GPIO of the device (active low unless it asks for SPI_CS_HIGH)
+    - Every chip-select is its own spi_device with its own mode, word size and speed
+      (cs_modes, cs_speeds, or SPI_IOC_WR_* at run time); the SPI core serialises their
+      messages, so one device's transfers never interleave with another's
 
   Define SPI Write Operation:
-    - Copy data from user-space to tx_buffer
-    - Call SPI data transfer function to send data to slave and receive response
+    - Copy data from user-space into a new job
+    - Wait for room in the submission queue (or fail with EAGAIN for O_NONBLOCK), append
+      the job and wake the pump; the caller can prepare its next write while this one is
+      on the wire
+
+  Define SPI Transfer Pump (kthread, optionally SCHED_FIFO and bound to pump_cpu):
+    - Take the oldest job off the submission queue; while a file owns the bus, the oldest
+      job of that file
+    - Clock exactly its bytes through the controller (spi_sync) on the chip-select device
+      of its file, keeping CS asserted for the whole write, and receive the slave's response
+      into the job
+    - With frame_bytes=N the write is split into N-byte frames and the slave is deselected
+      between them (cs_change), for slaves that expect short frames
+    - Account bytes and bus time; debugfs spi_master_bitbang/stats shows the throughput
+    - Move the job to the completion queue of the file that wrote it (or free it if that
+      file was closed meanwhile) and wake its readers
 
   Define SPI Read Operation:
-    - Copy data from rx_buffer to user-space (return received data)
+    - Wait for the oldest job of this file to finish (unless O_NONBLOCK); return 0 if the
+      file has nothing written that was not read yet
+    - Copy its received bytes to user-space (as many as fit, the rest is dropped), or
+      return the error of its transfer
+
+  Define SPI Message ioctl (SPI_IOC_MESSAGE(N), struct spi_ioc_transfer from <linux/spi/spidev.h>):
+    - Copy the N transfer descriptors from user-space; tx and rx of all of them together may
+      not exceed SPI_BUF_SIZE bytes each, and all lengths together (transfers without buffers
+      included) not INT_MAX, so the byte count fits the return value
+    - Gather the tx data into one kernel buffer, build one spi_transfer per descriptor with its
+      length, speed_hz, bits_per_word, delay_usecs, word_delay_usecs and cs_change
+    - Queue them as one message behind the earlier writes of this file (not while another
+      file owns the bus) and wait for the pump to run it (spi_sync), CS asserted throughout
+      unless cs_change says otherwise; a fatal signal takes it off the queue if it has not
+      started yet
+    - Scatter the received data to the rx pointers and return the number of bytes transferred
+
+  Define Bus Lock ioctls:
+    - BUS_LOCK: Wait until no other file owns the bus, claim it and queue a lock marker;
+      the pump takes the SPI core's bus lock (spi_bus_lock) when it reaches the marker and
+      runs only this file's messages, with spi_sync_locked, from then on; jobs queued before
+      the marker still run first
+    - BUS_UNLOCK (or closing the owning file): Queue an unlock marker; the pump drops the bus
+      lock there and goes back to running every file's jobs in order
 
   Initialize the Module:
     - Register a character device with a major number
-    - Request GPIO pins for MOSI, MISO, SCK, CS
+    - Request GPIO pins for MOSI, MISO, SCK, each CS (and IO2, IO3 if given)
     - Configure GPIO pin directions:
         - MOSI as output
         - MISO as input
         - SCK as output
-        - CS as output (active low)
+        - CS as output (inactive: high, or low for chip-selects in SPI_CS_HIGH mode)
+        - IO2, IO3 as outputs, high (inactive WP#/HOLD# on flash) outside quad transfers
+    - Register the SPI controller (dual I/O, and quad with IO2/IO3) and one device per
+      chip-select (bound to the "modalias" driver, if one is given)
+    - Start the transfer pump
     - Log the successful initialization
 
   Cleanup the Module:
+    - Stop the transfer pump and drop the jobs still queued
+    - Unregister the SPI controller (and with it the device)
     - Free requested GPIO pins
     - Unregister the character device
 
@@ -60,138 +138,1562 @@ End Module*/
 
 #include <linux/module.h>      // Required for creating kernel modules and related functions
 #include <linux/gpio.h>        // Required for GPIO management functions (requesting, reading, writing)
+#include <linux/gpio/consumer.h> // For the descriptors behind the GPIO numbers
+#include <linux/gpio/driver.h> // For finding the GPIO controller that owns the pins
+#include <linux/io.h>          // For the GPIO controller registers of the fast backend
 #include <linux/uaccess.h>     // For user-space access functions like copy_to_user and copy_from_user
-#include <linux/delay.h>       // For delay functions like udelay (microsecond delay) and msleep (millisecond delay)
+#include <linux/delay.h>       // For delay functions like udelay (microsecond delay) and ndelay (nanosecond delay)
 #include <linux/fs.h>          // For file system operations like read, write, and device registration
+#include <linux/mutex.h>       // For serialising the statistics
+#include <linux/spinlock.h>    // For the submission and completion queues
+#include <linux/list.h>        // For the queued jobs
+#include <linux/wait.h>        // For blocking readers, writers and the pump
+#include <linux/poll.h>        // For poll/select on the device
+#include <linux/kref.h>        // For open files that still have jobs in flight
+#include <linux/kthread.h>     // For the transfer pump
+#include <linux/sched.h>       // For running the pump SCHED_FIFO
+#include <linux/cpumask.h>     // For checking pump_cpu
+#include <linux/spi/spidev.h>  // For the SPI_IOC_MESSAGE transfer descriptors
+#include <linux/completion.h>  // For waiting on a queued SPI_IOC_MESSAGE
+#include "spi_bb_ioctl.h"      // For the bus lock ioctls shared with user space
+#include <linux/platform_device.h> // For the parent device of the SPI controller
+#include <linux/spi/spi.h>     // For the SPI controller and device structures
+#include <linux/spi/spi_bitbang.h> // For the kernel's bit-bang message and transfer handling
+#include <linux/slab.h>        // For the transfer descriptors of a write
+#include <linux/ktime.h>       // For timing transfers
+#include <linux/math64.h>      // For the throughput division
+#include <linux/debugfs.h>     // For publishing the transfer statistics
+#include <linux/seq_file.h>    // For formatting the statistics file
 
 #define DRIVER_NAME "spi_master_bitbang"  // Define the name of the driver
 #define GPIO_MOSI 535       // Define GPIO pin number for MOSI (Master Out Slave In) - output pin
 #define GPIO_MISO 536       // Define GPIO pin number for MISO (Master In Slave Out) - input pin
 #define GPIO_SCK  537       // Define GPIO pin number for SCK (Serial Clock) - output pin
-#define GPIO_CS   529       // Define GPIO pin number for CS (Chip Select) - output pin
+#define GPIO_CS   529       // Define GPIO pin number for CS (Chip Select) - output pin, unless cs_gpios is given
+#define SPI_BB_MAX_CS 8     // Chip-selects (and character device minors) at most
+#define SPI_BUF_SIZE 4096   // Largest write clocked out in one message (one job)
+#define SPI_MSG_MAX_XFERS (_IOC_SIZEMASK / sizeof(struct spi_ioc_transfer)) // Most N SPI_IOC_MESSAGE(N) encodes
+
+// BCM2835-family GPIO registers, one 32-bit word per bank of 32 pins
+#define GPSET0    0x1C      // Pin Output Set
+#define GPCLR0    0x28      // Pin Output Clear
+#define GPLEV0    0x34      // Pin Level
 
-static char tx_buffer[32] = "Hello SPI Slave!";  // Buffer to hold data to be sent to the slave
-static char rx_buffer[32];                        // Buffer to hold received data from the slave
 static int major=0;                               // Variable to hold the major number for device registration
+static DEFINE_MUTEX(spi_lock);                    // Protects the statistics
+
+static unsigned int speed_hz = 166666;  // 3 us half period, the rate of the old fixed udelay(3)
+module_param(speed_hz, uint, 0444);
+MODULE_PARM_DESC(speed_hz, "Default SCK rate of the chip-select devices in Hz (transfers may ask for their own)");
+
+static char *modalias;  // SPI device driver to bind to the chip-selects (e.g. "dh2228fv" for spidev)
+module_param(modalias, charp, 0444);
+MODULE_PARM_DESC(modalias, "Driver for the chip-select devices (none by default)");
+
+static int cs_gpios[SPI_BB_MAX_CS] = { GPIO_CS };  // One CS line per slave
+static int num_cs = 1;
+module_param_array(cs_gpios, int, &num_cs, 0444);
+MODULE_PARM_DESC(cs_gpios, "CS GPIO of each chip-select, e.g. cs_gpios=529,530 (default 529)");
+
+static int cs_modes[SPI_BB_MAX_CS];  // SPI_MODE_0 unless given
+module_param_array(cs_modes, int, NULL, 0444);
+MODULE_PARM_DESC(cs_modes, "SPI mode bits of each chip-select (0-3, | 0x04 CS_HIGH, | 0x08 LSB_FIRST)");
+
+static unsigned int cs_speeds[SPI_BB_MAX_CS];  // 0: speed_hz
+module_param_array(cs_speeds, uint, NULL, 0444);
+MODULE_PARM_DESC(cs_speeds, "SCK rate of each chip-select in Hz (0 = speed_hz)");
+
+static unsigned int frame_bytes;  // 0: hold CS for the whole write
+module_param(frame_bytes, uint, 0644);
+MODULE_PARM_DESC(frame_bytes, "Deselect the slave every N bytes of a write (0 = one frame per write)");
+
+static unsigned int queue_depth = 16;  // Writes that may wait for the pump
+module_param(queue_depth, uint, 0444);
+MODULE_PARM_DESC(queue_depth, "Writes queued for the transfer pump before writers block (at least 1); the bus owner gets as many of its own");
+
+static int pump_cpu = -1;  // -1: let the scheduler place the pump
+module_param(pump_cpu, int, 0444);
+MODULE_PARM_DESC(pump_cpu, "CPU the transfer pump is bound to (-1 = any)");
+
+static bool pump_fifo;
+module_param(pump_fifo, bool, 0444);
+MODULE_PARM_DESC(pump_fifo, "Run the transfer pump (and the SPI core's message pump) SCHED_FIFO");
+
+static int io2_gpio = -1;  // Quad I/O needs both extra lanes
+module_param(io2_gpio, int, 0444);
+MODULE_PARM_DESC(io2_gpio, "GPIO of data lane IO2 for quad I/O (-1 = dual I/O only)");
+
+static int io3_gpio = -1;
+module_param(io3_gpio, int, 0444);
+MODULE_PARM_DESC(io3_gpio, "GPIO of data lane IO3 for quad I/O (-1 = dual I/O only)");
+
+static bool fast_gpio = true;  // Use the GPIO registers when the pins are on a BCM2835-family chip
+module_param(fast_gpio, bool, 0444);
+MODULE_PARM_DESC(fast_gpio, "Drive SCK/MOSI and sample MISO through the GPSET/GPCLR/GPLEV registers where possible");
+
+// Controller state; spi-bitbang expects struct spi_bitbang first in the driver data
+struct spi_bb {
+    struct spi_bitbang bitbang;
+    struct platform_device *pdev;   // Parent of the controller
+    struct spi_device *spi[SPI_BB_MAX_CS]; // Chip-select devices, shared with the character device
+};
+
+// Open file of the character device: its finished writes, oldest first
+struct spi_bb_file {
+    struct kref ref;                // The file plus each of its jobs in flight
+    spinlock_t lock;                // Protects done, pending and closed
+    struct list_head done;          // Finished jobs waiting for read()
+    unsigned int pending;           // Jobs still queued or on the wire
+    bool closed;                    // Released; finished jobs are freed right away
+    wait_queue_head_t wait;         // Readers waiting for a job to finish
+    struct spi_device *spi;         // Chip-select of the minor the file was opened on
+    bool bus_held;                  // BUS_LOCK without BUS_UNLOCK yet (submit_lock)
+    unsigned int queued;            // Jobs in the submission queue (submit_lock)
+};
+
+// What a job asks the pump to do
+enum {
+    SPI_BB_JOB_WRITE,               // Clock out buf, receive into rx, hand back to read()
+    SPI_BB_JOB_MESSAGE,             // Run msg for SPI_IOC_MESSAGE, then complete done
+    SPI_BB_JOB_LOCK,                // Take the SPI core's bus lock for the file
+    SPI_BB_JOB_UNLOCK,              // Drop it again
+};
+
+// One write (or message, or bus lock marker) on its way through the submission queue and
+// back to its file
+struct spi_bb_job {
+    struct list_head node;          // In the submission queue, then in the file's done list
+    struct spi_bb_file *file;       // Writer, holds a reference
+    int kind;                       // SPI_BB_JOB_*
+    struct spi_message *msg;        // SPI_BB_JOB_MESSAGE: the ioctl's message
+    unsigned int frames;            // SPI_BB_JOB_MESSAGE: CS frames in it
+    struct completion done;         // SPI_BB_JOB_MESSAGE: the pump ran it
+    size_t len;                     // Bytes sent and received
+    int status;                     // 0, or the error of spi_sync()
+    u8 *rx;                         // Received bytes, behind the bytes to send in buf
+    u8 buf[];
+};
+
+// Character device transfer statistics (spi_lock)
+struct spi_bb_stats {
+    u64 messages;     // Writes clocked out
+    u64 frames;       // CS frames within them
+    u64 bytes;        // Bytes clocked out (and in)
+    u64 busy_ns;      // Time spent in spi_sync()
+};
+
+// Direct register access to SCK, MOSI and MISO (fast backend)
+struct spi_bb_regs {
+    void __iomem *base;             // GPIO block, NULL while gpiolib is used
+    void __iomem *sck_set, *sck_clr;
+    void __iomem *mosi_set, *mosi_clr;
+    void __iomem *miso_lev;
+    u32 sck, mosi, miso;            // Pin masks within their bank
+    bool combined;                  // SCK and MOSI share a bank: one write per edge
+    void __iomem *lanes_lev;        // Level register of the SCK bank
+    u32 lane[4];                    // Masks of IO0-IO3 within the SCK bank
+    bool lanes_grouped;             // SCK and all lanes share a bank: one access per edge
+};
+
+enum { SPI_BB_GPIOLIB, SPI_BB_FAST, SPI_BB_BACKENDS };
+
+static const char * const spi_bb_backend_names[SPI_BB_BACKENDS] = { "gpiolib", "registers" };
+
+static struct spi_bb *bb;                         // The one bit-bang bus
+static struct spi_bb_regs regs;
+static int backend;                               // Backend in use
+static int lane_gpio[4] = { GPIO_MOSI, GPIO_MISO, -1, -1 }; // IO0-IO3 of dual/quad transfers
+static unsigned int bit_ns[SPI_BB_BACKENDS];      // Measured cost of one bit without delays, 0 = n/a
+static unsigned int delay_trim_ns;                // Loop overhead taken off each half period
+static int (*spi_bb_bufs)(struct spi_device *spi, struct spi_transfer *t); // spi-bitbang's word loop driver
+
+// Clock of the last transfer, for debugfs (written by the message pump)
+struct spi_bb_clock {
+    u32 requested_hz;   // speed_hz of the transfer, or the device's max_speed_hz
+    u32 achieved_hz;    // Bits clocked divided by the time the transfer took
+    u32 half_period_ns; // Delay per half period after calibration
+    u32 bits;           // Bits in the transfer
+};
+
+static struct spi_bb_clock last_clock;
+static LIST_HEAD(submit_queue);                   // Jobs waiting for the pump, oldest first
+static DEFINE_SPINLOCK(submit_lock);              // Protects submit_queue and submit_count
+static unsigned int submit_count;                 // Jobs in submit_queue
+static DECLARE_WAIT_QUEUE_HEAD(submit_wq);        // The pump waits here for jobs
+static DECLARE_WAIT_QUEUE_HEAD(space_wq);         // Writers wait here for room in the queue
+static struct task_struct *pump_task;             // Transfer pump
+static struct spi_bb_file *bus_owner;             // File that holds the bus (submit_lock)
+static DECLARE_WAIT_QUEUE_HEAD(bus_wq);           // BUS_LOCK waits here for the owner to let go
+static bool bus_locked;                           // The pump reached the owner's lock marker and holds spi_bus_lock() (pump only)
+static struct spi_bb_stats stats;
+static struct dentry *spi_debugfs;                // debugfs spi_master_bitbang directory
+
+// Pin accessors of the inner loop, specialised on the backend
+static __always_inline void spi_bb_setsck(const int fast, int is_on)
+{
+    if (fast)
+        writel_relaxed(regs.sck, is_on ? regs.sck_set : regs.sck_clr); // Same-device accesses stay ordered
+    else
+        gpio_set_value(GPIO_SCK, is_on);
+}
+
+static __always_inline void spi_bb_setmosi(const int fast, int is_on)
+{
+    if (fast)
+        writel_relaxed(regs.mosi, is_on ? regs.mosi_set : regs.mosi_clr);
+    else
+        gpio_set_value(GPIO_MOSI, is_on);
+}
+
+static __always_inline int spi_bb_getmiso(const int fast)
+{
+    if (fast)
+        return !!(readl_relaxed(regs.miso_lev) & regs.miso);
+    return !!gpio_get_value(GPIO_MISO);
+}
 
-// SPI Data Transfer (Bit-banging)
-static void spi_master_transfer(void)
+// One clock edge, with MOSI changing at the same time unless mosi is -1; on a shared bank
+// both lines go out in a single GPSET and/or GPCLR write
+static __always_inline void spi_bb_edge(const int fast, int sck, int mosi)
 {
-    int byte_idx, bit_idx;
-    char received_byte = 0;
+    u32 set, clr;
 
-    // Loop through each byte in the tx_buffer to send to the slave
-    for (byte_idx = 0; byte_idx < sizeof(tx_buffer); byte_idx++) {
-        char byte_to_send = tx_buffer[byte_idx];  // Get the byte to be sent in the current iteration
+    if (!fast || !regs.combined || mosi < 0) {
+        spi_bb_setsck(fast, sck);
+        if (mosi >= 0)
+            spi_bb_setmosi(fast, mosi);
+        return;
+    }
+
+    set = (sck ? regs.sck : 0) | (mosi ? regs.mosi : 0);
+    clr = (sck ? 0 : regs.sck) | (mosi ? 0 : regs.mosi);
+    if (set)
+        writel_relaxed(set, regs.sck_set);
+    if (clr)
+        writel_relaxed(clr, regs.sck_clr);
+}
 
-        // Start communication by pulling CS (Chip Select) low
-        gpio_set_value(GPIO_CS, 0);  // CS pin low indicates start of communication
-        udelay(3);  // Small delay to simulate chip select activation
+/*
+ * Shift one word of 'bits' bits out on MOSI and in from MISO, MSB or LSB first. Always inlined
+ * into the per-mode, per-backend functions below with cpol/cpha/fast/lsb constant, so the
+ * compiler drops the branches on them.
+ * CPHA=0: data changes on the trailing edge of the previous bit and is sampled on the leading edge.
+ * CPHA=1: data changes on the leading edge and is sampled on the trailing edge.
+ */
+static __always_inline u32 spi_bb_txrx_bits(unsigned int nsecs, u32 word, u8 bits, unsigned int flags,
+                                            const int cpol, const int cpha, const int fast, const int lsb)
+{
+    const unsigned int rxshift = lsb ? bits - 1 : 0; // Where a received bit enters the word
+    const u32 txbit = lsb ? 1 : BIT(31);             // Bit that goes out next
+    u32 oldbit;
+    int mosi;
 
-        // Loop through each bit of the byte to send (MSB first)
-        for (bit_idx = 7; bit_idx >= 0; bit_idx--) {
-            // Set MOSI to the corresponding bit in the byte
-            int mosi_bit = (byte_to_send >> bit_idx) & 0x01;
-            gpio_set_value(GPIO_MOSI, mosi_bit);  // Set MOSI pin to the current bit value
+    // The GPIO accesses already take part of each half period
+    nsecs = nsecs > delay_trim_ns ? nsecs - delay_trim_ns : 0;
 
-            // Read the MISO pin (Master In Slave Out) for the received bit
-            int miso_bit = gpio_get_value(GPIO_MISO);
-            received_byte = (received_byte << 1) | miso_bit;  // Shift the received bit into the received byte
+    if (lsb)
+        word &= (u32)(BIT_ULL(bits) - 1); // Nothing above the word may shift down into it
+    else
+        word <<= 32 - bits;               // First bit at the top
+    oldbit = (word & txbit) ^ txbit;      // Forces the first MOSI write
 
-            // Toggle the SCK (Serial Clock) line for each bit
-            gpio_set_value(GPIO_SCK, 1);  // Set SCK high (rising edge)
-            udelay(3);  // Small delay to simulate clock pulse
-            gpio_set_value(GPIO_SCK, 0);  // Set SCK low (falling edge)
-            udelay(3);  // Small delay to simulate clock pulse
+    for (; likely(bits); bits--) {
+        // MOSI level for this bit, -1 when it does not change
+        mosi = -1;
+        if (!(flags & SPI_MASTER_NO_TX) && (word & txbit) != oldbit) {
+            oldbit = word & txbit;
+            mosi = !!oldbit;
         }
 
-        // Store the received byte in the rx_buffer
-        rx_buffer[byte_idx] = received_byte;
-        pr_info("RECEIVED BYTE: %c\n", received_byte);  // Log the received byte
+        spi_bb_edge(fast, cpha ? !cpol : cpol, mosi); // Edge on which the data changes
+        ndelay(nsecs);  // Half clock period
+
+        spi_bb_setsck(fast, cpha ? cpol : !cpol); // Sampling edge
+        ndelay(nsecs);  // Half clock period
+
+        // Shift the MISO bit into the received word
+        if (lsb)
+            word >>= 1;
+        else
+            word <<= 1;
+        if (!(flags & SPI_MASTER_NO_RX))
+            word |= (u32)spi_bb_getmiso(fast) << rxshift;
+    }
+
+    if (!cpha)
+        spi_bb_setsck(fast, cpol);  // Trailing edge of the last bit
+
+    return word;
+}
+
+#define SPI_BB_TXRX_WORD(name, cpol, cpha, fast)                                          \
+static u32 name(struct spi_device *spi, unsigned int nsecs, u32 word, u8 bits, unsigned int flags) \
+{                                                                                         \
+    if (spi->mode & SPI_LSB_FIRST)                                                        \
+        return spi_bb_txrx_bits(nsecs, word, bits, flags, cpol, cpha, fast, 1);           \
+    return spi_bb_txrx_bits(nsecs, word, bits, flags, cpol, cpha, fast, 0);               \
+}
+
+SPI_BB_TXRX_WORD(spi_bb_txrx_word_mode0, 0, 0, 0)
+SPI_BB_TXRX_WORD(spi_bb_txrx_word_mode1, 0, 1, 0)
+SPI_BB_TXRX_WORD(spi_bb_txrx_word_mode2, 1, 0, 0)
+SPI_BB_TXRX_WORD(spi_bb_txrx_word_mode3, 1, 1, 0)
+SPI_BB_TXRX_WORD(spi_bb_txrx_word_fast_mode0, 0, 0, 1)
+SPI_BB_TXRX_WORD(spi_bb_txrx_word_fast_mode1, 0, 1, 1)
+SPI_BB_TXRX_WORD(spi_bb_txrx_word_fast_mode2, 1, 0, 1)
+SPI_BB_TXRX_WORD(spi_bb_txrx_word_fast_mode3, 1, 1, 1)
+
+typedef u32 (*spi_bb_txrx_word_t)(struct spi_device *spi, unsigned int nsecs, u32 word, u8 bits, unsigned int flags);
 
-        // End communication by pulling CS high (deselect chip)
-        gpio_set_value(GPIO_CS, 1);  // Set CS pin high to end communication
-        udelay(3);  // Small delay to simulate chip deselection
+// Inner loops indexed by backend and SPI mode
+static const spi_bb_txrx_word_t spi_bb_txrx_word[SPI_BB_BACKENDS][4] = {
+    [SPI_BB_GPIOLIB] = { spi_bb_txrx_word_mode0, spi_bb_txrx_word_mode1,
+                         spi_bb_txrx_word_mode2, spi_bb_txrx_word_mode3 },
+    [SPI_BB_FAST]    = { spi_bb_txrx_word_fast_mode0, spi_bb_txrx_word_fast_mode1,
+                         spi_bb_txrx_word_fast_mode2, spi_bb_txrx_word_fast_mode3 },
+};
+
+// Drive lane i with bit i of val, and SCK to sck; one GPSET and one GPCLR write when grouped
+static __always_inline void spi_bb_lanes_out(const int fast, const int nbits, u32 val, int sck)
+{
+    u32 set, clr;
+    int i;
+
+    if (!fast || !regs.lanes_grouped) {
+        for (i = 0; i < nbits; i++)
+            gpio_set_value(lane_gpio[i], !!(val & BIT(i)));
+        spi_bb_setsck(fast, sck);
+        return;
+    }
+
+    set = sck ? regs.sck : 0;
+    clr = sck ? 0 : regs.sck;
+    for (i = 0; i < nbits; i++) {
+        if (val & BIT(i))
+            set |= regs.lane[i];
+        else
+            clr |= regs.lane[i];
     }
+    writel_relaxed(set, regs.sck_set);
+    writel_relaxed(clr, regs.sck_clr);
+}
+
+// Sample the lanes, lane i into bit i; one GPLEV read when grouped
+static __always_inline u32 spi_bb_lanes_in(const int fast, const int nbits)
+{
+    u32 lev, val = 0;
+    int i;
+
+    if (!fast || !regs.lanes_grouped) {
+        for (i = 0; i < nbits; i++)
+            val |= (u32)!!gpio_get_value(lane_gpio[i]) << i;
+        return val;
+    }
+
+    lev = readl_relaxed(regs.lanes_lev);
+    for (i = 0; i < nbits; i++)
+        if (lev & regs.lane[i])
+            val |= BIT(i);
+    return val;
+}
+
+/*
+ * Clock len bytes over nbits lanes, MSB first, sending tx or receiving into rx (one of them is
+ * NULL). Inlined per backend and lane count; the SCK levels of the two edges are computed once.
+ */
+static __always_inline void spi_bb_lanes_xfer(const u8 *tx, u8 *rx, unsigned int len, unsigned int nsecs,
+                                              int cpol, int cpha, const int fast, const int nbits)
+{
+    const int change = cpha ? !cpol : cpol; // SCK level after the edge on which data changes
+    const int sample = !change;             // and after the one on which it is sampled
+    unsigned int i;
+    int shift;
+    u32 in;
+
+    for (i = 0; i < len; i++) {
+        in = 0;
+        for (shift = 8 - nbits; shift >= 0; shift -= nbits) {
+            if (tx)
+                spi_bb_lanes_out(fast, nbits, tx[i] >> shift, change);
+            else
+                spi_bb_setsck(fast, change);
+            ndelay(nsecs);  // Half clock period
+
+            spi_bb_setsck(fast, sample);
+            ndelay(nsecs);  // Half clock period
+            if (rx)
+                in = (in << nbits) | spi_bb_lanes_in(fast, nbits);
+        }
+        if (rx)
+            rx[i] = in;
+    }
+
+    if (!cpha)
+        spi_bb_setsck(fast, cpol);  // Trailing edge of the last clock
+}
+
+#define SPI_BB_LANES_XFER(name, fast, nbits)                                              \
+static void name(const u8 *tx, u8 *rx, unsigned int len, unsigned int nsecs, int cpol, int cpha) \
+{                                                                                         \
+    spi_bb_lanes_xfer(tx, rx, len, nsecs, cpol, cpha, fast, nbits);                       \
+}
+
+SPI_BB_LANES_XFER(spi_bb_lanes_dual, 0, 2)
+SPI_BB_LANES_XFER(spi_bb_lanes_quad, 0, 4)
+SPI_BB_LANES_XFER(spi_bb_lanes_fast_dual, 1, 2)
+SPI_BB_LANES_XFER(spi_bb_lanes_fast_quad, 1, 4)
+
+typedef void (*spi_bb_lanes_t)(const u8 *tx, u8 *rx, unsigned int len, unsigned int nsecs, int cpol, int cpha);
+
+// Multi-lane loops indexed by backend and dual/quad
+static const spi_bb_lanes_t spi_bb_lanes[SPI_BB_BACKENDS][2] = {
+    [SPI_BB_GPIOLIB] = { spi_bb_lanes_dual, spi_bb_lanes_quad },
+    [SPI_BB_FAST]    = { spi_bb_lanes_fast_dual, spi_bb_lanes_fast_quad },
+};
+
+// Map the GPIO block when SCK, MOSI and MISO all belong to a BCM2835-family pin controller
+static int spi_bb_regs_init(void)
+{
+    struct gpio_chip *gc = gpiod_to_chip(gpio_to_desc(GPIO_SCK));
+    unsigned int sck, mosi, miso;
+    struct resource *res;
+    int i;
+
+    if (!gc || !gc->parent || strncmp(gc->label, "pinctrl-bcm2", 12))
+        return -ENODEV;
+    if (gpiod_to_chip(gpio_to_desc(GPIO_MOSI)) != gc || gpiod_to_chip(gpio_to_desc(GPIO_MISO)) != gc)
+        return -ENODEV;
+
+    res = platform_get_resource(to_platform_device(gc->parent), IORESOURCE_MEM, 0);
+    if (!res)
+        return -ENODEV;
+    // Shared with the pin controller, which owns the region
+    regs.base = ioremap(res->start, resource_size(res));
+    if (!regs.base)
+        return -ENOMEM;
+
+    // Pin numbers within the controller, then bank offset and bit
+    sck = GPIO_SCK - gc->base;
+    mosi = GPIO_MOSI - gc->base;
+    miso = GPIO_MISO - gc->base;
+    regs.sck = BIT(sck % 32);
+    regs.mosi = BIT(mosi % 32);
+    regs.miso = BIT(miso % 32);
+    regs.sck_set = regs.base + GPSET0 + 4 * (sck / 32);
+    regs.sck_clr = regs.base + GPCLR0 + 4 * (sck / 32);
+    regs.mosi_set = regs.base + GPSET0 + 4 * (mosi / 32);
+    regs.mosi_clr = regs.base + GPCLR0 + 4 * (mosi / 32);
+    regs.miso_lev = regs.base + GPLEV0 + 4 * (miso / 32);
+    regs.combined = sck / 32 == mosi / 32;
+
+    // Dual/quad lanes: grouped when they sit in the SCK bank of the same controller
+    regs.lanes_lev = regs.base + GPLEV0 + 4 * (sck / 32);
+    regs.lanes_grouped = true;
+    for (i = 0; i < 4 && lane_gpio[i] >= 0; i++) {
+        unsigned int pin = lane_gpio[i] - gc->base;
+
+        if (gpiod_to_chip(gpio_to_desc(lane_gpio[i])) != gc || pin / 32 != sck / 32)
+            regs.lanes_grouped = false;
+        regs.lane[i] = BIT(pin % 32);
+    }
+    return 0;
+}
+
+// Nanoseconds per bit of a backend's inner loop without delays, best of a few runs of 256 bits.
+// Only called before the controller is registered; CS is inactive, so slaves ignore the clock.
+static unsigned int spi_bb_measure(int which)
+{
+    s64 ns, best = S64_MAX;
+    ktime_t start;
+    int run, i;
+
+    for (run = 0; run < 8; run++) {
+        start = ktime_get();
+        for (i = 0; i < 32; i++) {
+            if (which == SPI_BB_FAST)
+                spi_bb_txrx_bits(0, 0xA5, 8, 0, 0, 0, 1, 0);
+            else
+                spi_bb_txrx_bits(0, 0xA5, 8, 0, 0, 0, 0, 0);
+        }
+        ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+        best = min(best, ns);
+    }
+
+    return max_t(unsigned int, DIV_ROUND_UP(best, 256), 1);
+}
+
+// Turn the first nbits lanes into outputs (to send) or inputs (to receive)
+static void spi_bb_lanes_dir(int nbits, bool out)
+{
+    int i;
+
+    for (i = 0; i < nbits; i++) {
+        if (out)
+            gpio_direction_output(lane_gpio[i], 0);
+        else
+            gpio_direction_input(lane_gpio[i]);
+    }
+}
+
+// Back to single SPI: MOSI driven, MISO an input, IO2/IO3 driven high
+static void spi_bb_lanes_single(void)
+{
+    int i;
+
+    gpio_direction_output(GPIO_MOSI, 0);
+    gpio_direction_input(GPIO_MISO);
+    for (i = 2; i < 4 && lane_gpio[i] >= 0; i++)
+        gpio_direction_output(lane_gpio[i], 1);
+}
+
+// Dual/quad transfer: half duplex, 8-bit words, at the transfer's clock
+static int spi_bb_txrx_lanes(struct spi_device *spi, struct spi_transfer *t, u32 hz, unsigned int nbits)
+{
+    u8 bpw = t->bits_per_word ? t->bits_per_word : spi->bits_per_word;
+    unsigned int nsecs;
+
+    if (!hz)
+        return -EINVAL;
+    nsecs = NSEC_PER_SEC / 2 / hz;
+    if ((t->tx_buf && t->rx_buf) || bpw != 8 || (nbits == SPI_NBITS_QUAD && lane_gpio[3] < 0))
+        return -EINVAL;
+    nsecs = nsecs > delay_trim_ns ? nsecs - delay_trim_ns : 0;
+
+    spi_bb_lanes_dir(nbits, !!t->tx_buf);
+    spi_bb_lanes[backend][nbits == SPI_NBITS_QUAD](t->tx_buf, t->rx_buf, t->len, nsecs,
+                                                   !!(spi->mode & SPI_CPOL), !!(spi->mode & SPI_CPHA));
+    spi_bb_lanes_single();
+    return t->len;
+}
+
+// Run one transfer through spi-bitbang's word loop and record the clock it achieved
+static int spi_bb_txrx_bufs(struct spi_device *spi, struct spi_transfer *t)
+{
+    u32 hz = t->speed_hz ? t->speed_hz : spi->max_speed_hz;
+    u8 bpw = t->bits_per_word ? t->bits_per_word : spi->bits_per_word;
+    unsigned int nbits = max(t->tx_buf ? t->tx_nbits : 0, t->rx_buf ? t->rx_nbits : 0);
+    ktime_t start = ktime_get();
+    s64 ns;
+    int n;
+
+    // The rate spi-bitbang's word loop runs at: no faster than the backend, no slower than 2 ms
+    // per half period
+    if (hz)
+        hz = clamp(hz, spi->master->min_speed_hz, spi->master->max_speed_hz);
+
+    // spi-bitbang only knows single-lane transfers
+    if (nbits > SPI_NBITS_SINGLE)
+        n = spi_bb_txrx_lanes(spi, t, hz, nbits);
+    else
+        n = spi_bb_bufs(spi, t);
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+    if (n > 0 && ns > 0) {
+        // Words are stored in 1, 2 or 4 bytes; clocks carry nbits bits each
+        u64 bits = (u64)n / (bpw <= 8 ? 1 : bpw <= 16 ? 2 : 4) * bpw / max(nbits, 1U);
+
+        WRITE_ONCE(last_clock.requested_hz, hz);
+        WRITE_ONCE(last_clock.achieved_hz, div64_u64(bits * NSEC_PER_SEC, ns));
+        WRITE_ONCE(last_clock.half_period_ns, hz ? max_t(int, NSEC_PER_SEC / 2 / hz - delay_trim_ns, 0) : 0);
+        WRITE_ONCE(last_clock.bits, bits);
+    }
+    return n;
+}
+
+// Drive the CS line of a device; SCK is parked at its idle level before the slave is selected
+static void spi_bb_chipselect(struct spi_device *spi, int is_on)
+{
+    if (is_on)
+        spi_bb_setsck(backend == SPI_BB_FAST, !!(spi->mode & SPI_CPOL));
+
+    // CS pin low indicates start of communication, unless the device is SPI_CS_HIGH
+    gpio_set_value(cs_gpios[spi->chip_select], (spi->mode & SPI_CS_HIGH) ? is_on : !is_on);
+}
+
+// Run a message from the pump; while it holds the bus lock only the _locked variant gets through
+static int spi_bb_sync(struct spi_device *spi, struct spi_message *msg)
+{
+    if (bus_locked)
+        return spi_sync_locked(spi, msg);
+    return spi_sync(spi, msg);
+}
+
+// Count a finished message in the statistics
+static void spi_bb_account(unsigned int frames, size_t bytes, s64 ns)
+{
+    mutex_lock(&spi_lock);
+    stats.messages++;
+    stats.frames += frames;
+    stats.bytes += bytes;
+    stats.busy_ns += ns;
+    mutex_unlock(&spi_lock);
+}
+
+// SPI Data Transfer: clock the bytes of a job as one message, CS asserted throughout
+// unless frame_bytes splits it (called by the pump only)
+static int spi_master_transfer(struct spi_bb_job *job)
+{
+    size_t len = job->len;
+    unsigned int frame = READ_ONCE(frame_bytes);
+    struct spi_transfer *xfers;
+    struct spi_message msg;
+    unsigned int i, n;
+    ktime_t start;
+    s64 ns;
+    int ret;
+
+    if (!frame || frame > len)
+        frame = len;
+    n = DIV_ROUND_UP(len, frame);
+
+    xfers = kcalloc(n, sizeof(*xfers), GFP_KERNEL);
+    if (!xfers)
+        return -ENOMEM;
+
+    spi_message_init(&msg);
+    for (i = 0; i < n; i++) {
+        xfers[i].tx_buf = job->buf + i * frame;
+        xfers[i].rx_buf = job->rx + i * frame;
+        xfers[i].len = min_t(size_t, frame, len - i * frame);
+        xfers[i].cs_change = i < n - 1;  // Deselect between frames; the core deselects after the last
+        xfers[i].cs_change_delay.value = 3;  // CS stays high for 3 us between frames
+        xfers[i].cs_change_delay.unit = SPI_DELAY_UNIT_USECS;
+        spi_message_add_tail(&xfers[i], &msg);
+    }
+
+    start = ktime_get();
+    ret = spi_bb_sync(job->file->spi, &msg);  // Queued behind any other user of the controller
+    ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+    kfree(xfers);
+    if (ret)
+        return ret;
+
+    spi_bb_account(n, len, ns);
 
     // Log the complete data that was sent and received
-    pr_info("SPI Master Sent Data: %s\n", tx_buffer);
-    pr_info("SPI Master Received Data: %s\n", rx_buffer);
+    pr_debug("SPI Master Sent Data: %.*s\n", (int)len, job->buf);
+    pr_debug("SPI Master Received Data: %.*s\n", (int)len, job->rx);
+    pr_debug("%zu bytes in %u frames, %lld ns\n", len, n, ns);
+    return 0;
+}
+
+static void spi_bb_file_free(struct kref *ref)
+{
+    kfree(container_of(ref, struct spi_bb_file, ref));
+}
+
+// Hand a finished job back to the file that wrote it
+static void spi_bb_job_done(struct spi_bb_job *job)
+{
+    struct spi_bb_file *f = job->file;
+
+    if (job->kind == SPI_BB_JOB_MESSAGE) {
+        complete(&job->done);  // The ioctl frees it
+    } else if (job->kind != SPI_BB_JOB_WRITE) {
+        kfree(job);  // Lock markers have no result
+    } else {
+        spin_lock(&f->lock);
+        f->pending--;
+        if (f->closed)
+            kfree(job);  // Nobody left to read it
+        else
+            list_add_tail(&job->node, &f->done);
+        spin_unlock(&f->lock);
+        wake_up_interruptible(&f->wait);
+    }
+
+    kref_put(&f->ref, spi_bb_file_free);
+}
+
+// Next job for the pump: the oldest one, or once the pump took the bus lock, the oldest one of
+// the file that owns the bus (submit_lock held). Jobs queued before the lock marker run first.
+static struct spi_bb_job *spi_bb_next_job(void)
+{
+    struct spi_bb_job *job;
+
+    list_for_each_entry(job, &submit_queue, node)
+        if (!bus_locked || job->file == bus_owner)
+            return job;
+    return NULL;
 }
 
-// File operation: Write data from user space to the tx_buffer
+static bool spi_bb_pump_ready(void)
+{
+    bool ready;
+
+    spin_lock(&submit_lock);
+    ready = spi_bb_next_job() != NULL;
+    spin_unlock(&submit_lock);
+    return ready;
+}
+
+// Transfer pump: run the queued jobs one after the other. spi_sync() runs the message in this
+// thread while the controller is idle, so its scheduling class and CPU are the ones that count.
+static int spi_bb_pump(void *data)
+{
+    struct spi_master *master = bb->bitbang.master;
+    struct spi_bb_job *job;
+    ktime_t start;
+
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(submit_wq, spi_bb_pump_ready() || kthread_should_stop());
+
+        spin_lock(&submit_lock);
+        job = spi_bb_next_job();
+        if (job) {
+            list_del_init(&job->node);  // Empty node: started, spi_bb_cancel() cannot take it back
+            submit_count--;
+            job->file->queued--;
+        }
+        spin_unlock(&submit_lock);
+        if (!job)
+            continue;
+        wake_up(&space_wq);  // Room for one more write (of the bus owner, or of anyone)
+
+        switch (job->kind) {
+        case SPI_BB_JOB_WRITE:
+            job->status = spi_master_transfer(job);
+            break;
+        case SPI_BB_JOB_MESSAGE:
+            start = ktime_get();
+            job->status = spi_bb_sync(job->file->spi, job->msg);
+            if (!job->status)
+                spi_bb_account(job->frames, job->len, ktime_to_ns(ktime_sub(ktime_get(), start)));
+            break;
+        case SPI_BB_JOB_LOCK:
+            spi_bus_lock(master);  // Waits for messages of other clients still on the wire
+            bus_locked = true;
+            break;
+        case SPI_BB_JOB_UNLOCK:
+            if (bus_locked)
+                spi_bus_unlock(master);
+            bus_locked = false;
+            spin_lock(&submit_lock);
+            bus_owner = NULL;
+            spin_unlock(&submit_lock);
+            wake_up_interruptible(&bus_wq);
+            wake_up(&space_wq);  // Messages of other files may be queued again
+            break;
+        }
+        spi_bb_job_done(job);
+    }
+
+    // The lock belongs to this thread
+    if (bus_locked)
+        spi_bus_unlock(master);
+    bus_locked = false;
+    return 0;
+}
+
+// Room for one more job of f (submit_lock held). Only the bus owner's jobs run while it holds the
+// bus, so it must not wait behind the others' jobs: it gets queue_depth jobs of its own instead.
+static bool spi_bb_room(struct spi_bb_file *f)
+{
+    if (bus_owner == f)
+        return f->queued < queue_depth;
+    return submit_count < queue_depth;
+}
+
+// Whether job may be queued now (submit_lock held). Lock markers always may. A message waits while
+// another file owns the bus: it could not run before that file unlocks, and its caller sleeps
+// until it ran.
+static bool spi_bb_can_submit(struct spi_bb_file *f, struct spi_bb_job *job)
+{
+    if (job->kind == SPI_BB_JOB_LOCK || job->kind == SPI_BB_JOB_UNLOCK)
+        return true;
+    if (job->kind == SPI_BB_JOB_MESSAGE && bus_owner && bus_owner != f)
+        return false;
+    return spi_bb_room(f);
+}
+
+static bool spi_bb_submit_ready(struct spi_bb_file *f, struct spi_bb_job *job)
+{
+    bool ready;
+
+    spin_lock(&submit_lock);
+    ready = spi_bb_can_submit(f, job);
+    spin_unlock(&submit_lock);
+    return ready;
+}
+
+// Queue a job for the pump, waiting until spi_bb_can_submit() lets it in
+static int spi_bb_submit(struct file *file, struct spi_bb_job *job)
+{
+    struct spi_bb_file *f = file->private_data;
+    int ret;
+
+    spin_lock(&submit_lock);
+    while (!spi_bb_can_submit(f, job)) {
+        spin_unlock(&submit_lock);
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(space_wq, spi_bb_submit_ready(f, job));
+        if (ret)
+            return ret;
+        spin_lock(&submit_lock);
+    }
+
+    if (job->kind == SPI_BB_JOB_WRITE) {
+        spin_lock(&f->lock);
+        f->pending++;
+        spin_unlock(&f->lock);
+    }
+    job->file = f;
+    kref_get(&f->ref);  // Dropped by spi_bb_job_done()
+    list_add_tail(&job->node, &submit_queue);
+    submit_count++;
+    f->queued++;
+    spin_unlock(&submit_lock);
+
+    wake_up(&submit_wq);  // Wake the pump
+    return 0;
+}
+
+// Take a message the pump has not started back off the submission queue; false if it has
+static bool spi_bb_cancel(struct spi_bb_job *job)
+{
+    bool queued;
+
+    spin_lock(&submit_lock);
+    queued = !list_empty(&job->node);
+    if (queued) {
+        list_del_init(&job->node);
+        submit_count--;
+        job->file->queued--;
+    }
+    spin_unlock(&submit_lock);
+    if (!queued)
+        return false;
+
+    wake_up(&space_wq);
+    kref_put(&job->file->ref, spi_bb_file_free);
+    return true;
+}
+
+// Queue a bus lock or unlock marker; it is never dropped
+static void spi_bb_submit_marker(struct file *file, int kind)
+{
+    struct spi_bb_job *job = kzalloc(sizeof(*job), GFP_KERNEL | __GFP_NOFAIL);
+
+    job->kind = kind;
+    spi_bb_submit(file, job);  // Markers do not wait for room
+}
+
+// File operation: Create the completion queue of a new open file
+static int spi_open(struct inode *inode, struct file *file)
+{
+    unsigned int minor = iminor(inode);
+    struct spi_bb_file *f;
+
+    if (minor >= num_cs)
+        return -ENODEV;  // No such chip-select
+    f = kzalloc(sizeof(*f), GFP_KERNEL);
+    if (!f)
+        return -ENOMEM;
+    f->spi = bb->spi[minor];
+    kref_init(&f->ref);
+    spin_lock_init(&f->lock);
+    INIT_LIST_HEAD(&f->done);
+    init_waitqueue_head(&f->wait);
+    file->private_data = f;
+    return 0;
+}
+
+// File operation: Drop the unread results; jobs still in flight are freed when they finish
+static int spi_release(struct inode *inode, struct file *file)
+{
+    struct spi_bb_file *f = file->private_data;
+    struct spi_bb_job *job, *tmp;
+    LIST_HEAD(done);
+
+    // Let go of the bus; the file's queued messages still run first
+    spin_lock(&submit_lock);
+    if (f->bus_held) {
+        f->bus_held = false;
+        spin_unlock(&submit_lock);
+        spi_bb_submit_marker(file, SPI_BB_JOB_UNLOCK);
+    } else {
+        spin_unlock(&submit_lock);
+    }
+
+    spin_lock(&f->lock);
+    f->closed = true;
+    list_splice_init(&f->done, &done);
+    spin_unlock(&f->lock);
+
+    list_for_each_entry_safe(job, tmp, &done, node)
+        kfree(job);
+    kref_put(&f->ref, spi_bb_file_free);
+    return 0;
+}
+
+// File operation: Queue data from user space for the pump; returns before it is on the wire
 static ssize_t spi_write(struct file *file, const char __user *buff, size_t len, loff_t *offset)
 {
-    // Copy data from user space to the kernel buffer (tx_buffer)
-    if (copy_from_user(tx_buffer, buff, len)) {
+    struct spi_bb_job *job;
+    int ret;
+
+    len = min_t(size_t, len, SPI_BUF_SIZE);  // The rest would not fit in one message
+    if (!len)
+        return 0;
+
+    job = kzalloc(struct_size(job, buf, 2 * len), GFP_KERNEL);
+    if (!job)
+        return -ENOMEM;
+    job->kind = SPI_BB_JOB_WRITE;
+    job->len = len;
+    job->rx = job->buf + len;
+
+    // Copy data from user space to the job
+    if (copy_from_user(job->buf, buff, len)) {
+        kfree(job);
         pr_info("Unable to copy from user\n");  // Log an error if copy fails
         return -EINVAL;  // Return error
     }
 
-    // Perform the SPI master transfer function (send and receive data)
-    spi_master_transfer();
+    // Wait for room in the submission queue
+    ret = spi_bb_submit(file, job);
+    if (ret) {
+        kfree(job);
+        return ret;
+    }
 
     return len;  // Return the length of data written
 }
 
-// File operation: Read data from the rx_buffer (received data) to user space
+// Something to read, or nothing left to wait for
+static bool spi_bb_file_ready(struct spi_bb_file *f)
+{
+    bool ready;
+
+    spin_lock(&f->lock);
+    ready = !list_empty(&f->done) || !f->pending;
+    spin_unlock(&f->lock);
+    return ready;
+}
+
+// File operation: Read the data received by the oldest finished write of this file
 static ssize_t spi_read(struct file *file, char __user *buff, size_t len, loff_t *offset)
 {
-    // Copy data from the kernel buffer (rx_buffer) to user space
-    if (copy_to_user(buff, rx_buffer, len)) {
-        pr_info("Unable to copy to user\n");  // Log an error if copy fails
-        return -EINVAL;  // Return error
+    struct spi_bb_file *f = file->private_data;
+    struct spi_bb_job *job;
+    ssize_t ret;
+
+    spin_lock(&f->lock);
+    while (list_empty(&f->done)) {
+        bool idle = !f->pending;
+
+        spin_unlock(&f->lock);
+        if (idle)
+            return 0;  // Every write has been read
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(f->wait, spi_bb_file_ready(f));
+        if (ret)
+            return ret;
+        spin_lock(&f->lock);
+    }
+    job = list_first_entry(&f->done, struct spi_bb_job, node);
+    list_del(&job->node);
+    spin_unlock(&f->lock);
+
+    if (job->status) {
+        ret = job->status;  // The transfer failed
+    } else {
+        len = min(len, job->len);  // Bytes that do not fit are dropped
+
+        // Copy data from the job to user space
+        if (copy_to_user(buff, job->rx, len)) {
+            spin_lock(&f->lock);
+            list_add(&job->node, &f->done);  // Keep it for the next read
+            spin_unlock(&f->lock);
+            pr_info("Unable to copy to user\n");  // Log an error if copy fails
+            return -EINVAL;  // Return error
+        }
+        ret = len;
+    }
+
+    kfree(job);
+    return ret;  // Return the length of data read
+}
+
+// File operation: Readable once a write finished, writable while the submission queue has room
+static __poll_t spi_poll(struct file *file, poll_table *wait)
+{
+    struct spi_bb_file *f = file->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(file, &f->wait, wait);
+    poll_wait(file, &space_wq, wait);
+
+    spin_lock(&f->lock);
+    if (!list_empty(&f->done))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    spin_unlock(&f->lock);
+    spin_lock(&submit_lock);
+    if (spi_bb_room(f))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    spin_unlock(&submit_lock);
+
+    return mask;
+}
+
+// SPI_IOC_MESSAGE(n): run n spidev-style transfers as one message on the file's chip-select
+static int spi_bb_message(struct file *file, struct spi_ioc_transfer __user *uxfers, unsigned int n)
+{
+    struct spi_ioc_transfer *ioc;
+    struct spi_transfer *xfers;
+    struct spi_message msg;
+    struct spi_bb_job job = { .kind = SPI_BB_JOB_MESSAGE, .msg = &msg, .frames = 1 };
+    size_t tx_total = 0, rx_total = 0, total = 0;
+    unsigned int i;
+    u8 *tx, *rx;
+    int ret;
+
+    if (n > SPI_MSG_MAX_XFERS)
+        return -EINVAL;
+    ioc = memdup_user(uxfers, n * sizeof(*ioc));
+    if (IS_ERR(ioc))
+        return PTR_ERR(ioc);
+
+    // Everything has to fit the bounce buffers, and the byte count the return value
+    for (i = 0; i < n; i++) {
+        if (ioc[i].tx_buf)
+            tx_total += ioc[i].len;
+        if (ioc[i].rx_buf)
+            rx_total += ioc[i].len;
+        total += ioc[i].len;
+        if (tx_total > SPI_BUF_SIZE || rx_total > SPI_BUF_SIZE || total > INT_MAX) {
+            ret = -EMSGSIZE;
+            goto out_ioc;
+        }
+    }
+
+    xfers = kcalloc(n, sizeof(*xfers), GFP_KERNEL);
+    tx = kmalloc(tx_total + rx_total, GFP_KERNEL);
+    if (!xfers || !tx) {
+        ret = -ENOMEM;
+        goto out_bufs;
+    }
+    rx = tx + tx_total;
+
+    spi_message_init(&msg);
+    for (i = 0, tx_total = rx_total = 0; i < n; i++) {
+        struct spi_transfer *t = &xfers[i];
+
+        t->len = ioc[i].len;
+        if (ioc[i].tx_buf) {
+            t->tx_buf = tx + tx_total;
+            if (copy_from_user(tx + tx_total, u64_to_user_ptr(ioc[i].tx_buf), t->len)) {
+                ret = -EFAULT;
+                goto out_bufs;
+            }
+            tx_total += t->len;
+        }
+        if (ioc[i].rx_buf) {
+            t->rx_buf = rx + rx_total;
+            rx_total += t->len;
+        }
+        t->speed_hz = ioc[i].speed_hz;
+        t->bits_per_word = ioc[i].bits_per_word;
+        t->tx_nbits = ioc[i].tx_nbits;
+        t->rx_nbits = ioc[i].rx_nbits;
+        t->delay.value = ioc[i].delay_usecs;
+        t->delay.unit = SPI_DELAY_UNIT_USECS;
+        t->word_delay.value = ioc[i].word_delay_usecs;
+        t->word_delay.unit = SPI_DELAY_UNIT_USECS;
+        t->cs_change = !!ioc[i].cs_change;
+        if (t->cs_change && i < n - 1)
+            job.frames++;
+        spi_message_add_tail(t, &msg);
+    }
+
+    // Behind the earlier writes of this file; the core validates speeds, word sizes and nbits
+    job.len = total;
+    init_completion(&job.done);
+    ret = spi_bb_submit(file, &job);
+    if (ret)
+        goto out_bufs;
+    ret = wait_for_completion_killable(&job.done);
+    if (ret && !spi_bb_cancel(&job))
+        wait_for_completion(&job.done);  // On the wire already: the pump uses msg until it is done
+    if (!ret)
+        ret = job.status;
+    if (ret)
+        goto out_bufs;
+
+    // Hand the received data back
+    for (i = 0, rx_total = 0; i < n; i++) {
+        if (!ioc[i].rx_buf)
+            continue;
+        if (copy_to_user(u64_to_user_ptr(ioc[i].rx_buf), rx + rx_total, ioc[i].len)) {
+            ret = -EFAULT;
+            goto out_bufs;
+        }
+        rx_total += ioc[i].len;
+    }
+    ret = total;
+
+out_bufs:
+    kfree(tx);
+    kfree(xfers);
+out_ioc:
+    kfree(ioc);
+    return ret;
+}
+
+// Change the settings of the file's chip-select; never while one of its messages is on the wire
+static int spi_bb_setup(struct spi_bb_file *f, u32 mode, u8 bits, u32 hz)
+{
+    struct spi_device *spi = f->spi;
+    u32 old_mode = spi->mode, old_hz = spi->max_speed_hz;
+    u8 old_bits = spi->bits_per_word;
+    int ret;
+
+    if (READ_ONCE(f->bus_held))
+        return -EBUSY;  // The pump holds the bus lock on our behalf
+
+    spi_bus_lock(spi->master);
+    spi->mode = mode;
+    spi->bits_per_word = bits;
+    spi->max_speed_hz = hz;
+    ret = spi_setup(spi);
+    if (ret) {
+        spi->mode = old_mode;
+        spi->bits_per_word = old_bits;
+        spi->max_speed_hz = old_hz;
+    }
+    spi_bus_unlock(spi->master);
+    return ret;
+}
+
+// BUS_LOCK: claim the bus for this file, then have the pump take the SPI core's bus lock
+static int spi_bb_bus_lock(struct file *file)
+{
+    struct spi_bb_file *f = file->private_data;
+    int ret;
+
+    spin_lock(&submit_lock);
+    while (bus_owner) {
+        bool held = f->bus_held;
+
+        spin_unlock(&submit_lock);
+        if (held)
+            return -EBUSY;  // Already ours
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(bus_wq, !READ_ONCE(bus_owner));
+        if (ret)
+            return ret;
+        spin_lock(&submit_lock);
+    }
+    bus_owner = f;
+    f->bus_held = true;
+    spin_unlock(&submit_lock);
+    wake_up(&space_wq);  // Writers of this file now have a queue_depth of their own
+
+    spi_bb_submit_marker(file, SPI_BB_JOB_LOCK);
+    return 0;
+}
+
+// BUS_UNLOCK: the pump lets go once it gets to the marker
+static int spi_bb_bus_unlock(struct file *file)
+{
+    struct spi_bb_file *f = file->private_data;
+
+    spin_lock(&submit_lock);
+    if (!f->bus_held) {
+        spin_unlock(&submit_lock);
+        return -EPERM;
+    }
+    f->bus_held = false;
+    spin_unlock(&submit_lock);
+
+    spi_bb_submit_marker(file, SPI_BB_JOB_UNLOCK);
+    return 0;
+}
+
+// File operation: spidev's SPI_IOC_MESSAGE(N) and settings requests, plus the bus lock
+static long spi_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct spi_bb_file *f = file->private_data;
+    struct spi_device *spi = f->spi;
+    unsigned int size = _IOC_SIZE(cmd);
+    u32 tmp;
+    int ret;
+
+    switch (cmd) {
+    case SPI_BB_IOC_BUS_LOCK:
+        return spi_bb_bus_lock(file);
+    case SPI_BB_IOC_BUS_UNLOCK:
+        return spi_bb_bus_unlock(file);
+
+    // Read the chip-select's settings
+    case SPI_IOC_RD_MODE:
+        return put_user(spi->mode & 0xff, (__u8 __user *)arg);
+    case SPI_IOC_RD_MODE32:
+        return put_user(spi->mode, (__u32 __user *)arg);
+    case SPI_IOC_RD_LSB_FIRST:
+        return put_user(!!(spi->mode & SPI_LSB_FIRST), (__u8 __user *)arg);
+    case SPI_IOC_RD_BITS_PER_WORD:
+        return put_user(spi->bits_per_word, (__u8 __user *)arg);
+    case SPI_IOC_RD_MAX_SPEED_HZ:
+        return put_user(spi->max_speed_hz, (__u32 __user *)arg);
+
+    // Change them; spi_setup() checks them against the controller
+    case SPI_IOC_WR_MODE:
+    case SPI_IOC_WR_LSB_FIRST:
+    case SPI_IOC_WR_BITS_PER_WORD: {
+        u8 val;
+
+        ret = get_user(val, (__u8 __user *)arg);
+        if (ret)
+            return ret;
+        if (cmd == SPI_IOC_WR_MODE)
+            return spi_bb_setup(f, (spi->mode & ~0xffU) | val, spi->bits_per_word, spi->max_speed_hz);
+        if (cmd == SPI_IOC_WR_LSB_FIRST)
+            return spi_bb_setup(f, val ? spi->mode | SPI_LSB_FIRST : spi->mode & ~SPI_LSB_FIRST,
+                                spi->bits_per_word, spi->max_speed_hz);
+        return spi_bb_setup(f, spi->mode, val, spi->max_speed_hz);
+    }
+    case SPI_IOC_WR_MODE32:
+        ret = get_user(tmp, (__u32 __user *)arg);
+        return ret ? ret : spi_bb_setup(f, tmp, spi->bits_per_word, spi->max_speed_hz);
+    case SPI_IOC_WR_MAX_SPEED_HZ:
+        ret = get_user(tmp, (__u32 __user *)arg);
+        if (ret)
+            return ret;
+        if (!tmp)
+            return -EINVAL;
+        return spi_bb_setup(f, spi->mode, spi->bits_per_word, tmp);
     }
 
-    return len;  // Return the length of data read
+    // SPI_IOC_MESSAGE(N): the size encodes N
+    if (_IOC_TYPE(cmd) != SPI_IOC_MAGIC || _IOC_NR(cmd) != _IOC_NR(SPI_IOC_MESSAGE(0)) ||
+        _IOC_DIR(cmd) != _IOC_WRITE)
+        return -ENOTTY;
+    if (size % sizeof(struct spi_ioc_transfer))
+        return -EINVAL;
+    if (!size)
+        return 0;
+
+    return spi_bb_message(file, (struct spi_ioc_transfer __user *)arg, size / sizeof(struct spi_ioc_transfer));
 }
 
+// Start the transfer pump, bound to pump_cpu and SCHED_FIFO if asked to
+static int spi_bb_pump_start(void)
+{
+    if (pump_cpu >= 0 && (pump_cpu >= nr_cpu_ids || !cpu_online(pump_cpu)))
+        return -EINVAL;
+
+    pump_task = kthread_create(spi_bb_pump, NULL, "spi_bb_pump");
+    if (IS_ERR(pump_task))
+        return PTR_ERR(pump_task);
+    if (pump_cpu >= 0)
+        kthread_bind(pump_task, pump_cpu);
+    if (pump_fifo)
+        sched_set_fifo(pump_task);
+    wake_up_process(pump_task);
+    return 0;
+}
+
+// Stop the pump and fail the jobs it did not get to
+static void spi_bb_pump_stop(void)
+{
+    struct spi_bb_job *job, *tmp;
+    LIST_HEAD(queued);
+
+    kthread_stop(pump_task);
+
+    spin_lock(&submit_lock);
+    list_splice_init(&submit_queue, &queued);
+    submit_count = 0;
+    spin_unlock(&submit_lock);
+
+    list_for_each_entry_safe(job, tmp, &queued, node) {
+        list_del_init(&job->node);
+        job->status = -ESHUTDOWN;
+        spi_bb_job_done(job);
+    }
+}
+
+// debugfs spi_master_bitbang/stats: character device throughput
+static int spi_bb_stats_show(struct seq_file *m, void *v)
+{
+    struct spi_bb_stats s;
+    int i;
+
+    mutex_lock(&spi_lock);
+    s = stats;
+    mutex_unlock(&spi_lock);
+
+    seq_printf(m, "messages: %llu\nframes: %llu\nbytes: %llu\nbusy_ns: %llu\n",
+               s.messages, s.frames, s.bytes, s.busy_ns);
+    seq_printf(m, "bytes_per_sec: %llu\n", s.busy_ns ? div64_u64(s.bytes * NSEC_PER_SEC, s.busy_ns) : 0);
+    seq_printf(m, "queued: %u/%u\n", READ_ONCE(submit_count), queue_depth);
+
+    seq_printf(m, "backend: %s\n", spi_bb_backend_names[backend]);
+    for (i = 0; i < SPI_BB_BACKENDS; i++)
+        if (bit_ns[i])
+            seq_printf(m, "max_sck_hz_%s: %lu\n", spi_bb_backend_names[i], NSEC_PER_SEC / bit_ns[i]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(spi_bb_stats);
+
+// debugfs spi_master_bitbang/clock: requested versus achieved SCK of the last transfer
+static int spi_bb_clock_show(struct seq_file *m, void *v)
+{
+    seq_printf(m, "requested_hz: %u\nachieved_hz: %u\n",
+               READ_ONCE(last_clock.requested_hz), READ_ONCE(last_clock.achieved_hz));
+    seq_printf(m, "half_period_ns: %u\ndelay_trim_ns: %u\nbits: %u\n",
+               READ_ONCE(last_clock.half_period_ns), delay_trim_ns, READ_ONCE(last_clock.bits));
+    seq_printf(m, "max_hz: %lu\n", NSEC_PER_SEC / bit_ns[backend]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(spi_bb_clock);
+
 // Define the file operations for the SPI master driver
 static struct file_operations fops = {
+    .owner = THIS_MODULE,
+    .open = spi_open,        // Create the file's completion queue
+    .release = spi_release,  // Drop it
     .write = spi_write,  // Assign write function for writing data to the driver
     .read = spi_read,    // Assign read function for reading data from the driver
+    .poll = spi_poll,    // Wait for finished writes or queue room
+    .unlocked_ioctl = spi_ioctl,          // Batched transfers (SPI_IOC_MESSAGE), settings, bus lock
+    .compat_ioctl = compat_ptr_ioctl,     // The descriptors are the same for 32-bit callers
 };
 
+// Register the bit-bang SPI controller and a device for each chip-select
+static int spi_bb_register(void)
+{
+    struct spi_board_info info = { };
+    bool quad = lane_gpio[3] >= 0;
+    u32 lanes = SPI_TX_DUAL | SPI_RX_DUAL;
+    struct platform_device *pdev;
+    struct spi_master *master;
+    int i, ret;
+
+    // Pick the backend and measure what each available one can do
+    backend = SPI_BB_GPIOLIB;
+    if (fast_gpio && !spi_bb_regs_init())
+        backend = SPI_BB_FAST;
+    for (i = 0; i <= backend; i++) {
+        bit_ns[i] = spi_bb_measure(i);
+        pr_info("%s backend: %u ns per bit, max SCK %lu Hz\n", spi_bb_backend_names[i],
+                bit_ns[i], NSEC_PER_SEC / bit_ns[i]);
+    }
+    delay_trim_ns = bit_ns[backend] / 2;  // Spread over the two half periods of a bit
+
+    pdev = platform_device_register_simple(DRIVER_NAME, PLATFORM_DEVID_NONE, NULL, 0);
+    if (IS_ERR(pdev))
+        return PTR_ERR(pdev);
+
+    master = spi_alloc_master(&pdev->dev, sizeof(*bb));
+    if (!master) {
+        ret = -ENOMEM;
+        goto err_pdev;
+    }
+
+    bb = spi_master_get_devdata(master);
+    bb->pdev = pdev;
+    master->bus_num = -1;  // Next free bus number
+    master->num_chipselect = num_cs;
+    if (quad)
+        lanes |= SPI_TX_QUAD | SPI_RX_QUAD;
+    master->mode_bits = SPI_CPOL | SPI_CPHA | SPI_CS_HIGH | SPI_LSB_FIRST | lanes;
+    master->bits_per_word_mask = SPI_BPW_RANGE_MASK(4, 32);
+    master->max_speed_hz = NSEC_PER_SEC / bit_ns[backend]; // Faster requests are clamped to it
+    master->min_speed_hz = 250;  // spi-bitbang refuses half periods above 2 ms
+    master->rt = pump_fifo;      // Messages of other clients go through the core's pump
+
+    // spi-bitbang runs the message queue, computes the half period from speed_hz
+    // and calls the txrx_word of the device's mode for every word
+    bb->bitbang.master = master;
+    bb->bitbang.chipselect = spi_bb_chipselect;
+    for (i = 0; i < 4; i++)
+        bb->bitbang.txrx_word[i] = spi_bb_txrx_word[backend][i];
+
+    // Let spi-bitbang fill in its defaults, then time its transfers; spi_bitbang_start()
+    // keeps a txrx_bufs that is already set
+    ret = spi_bitbang_init(&bb->bitbang);
+    if (ret)
+        goto err_master;
+    spi_bb_bufs = bb->bitbang.txrx_bufs;
+    bb->bitbang.txrx_bufs = spi_bb_txrx_bufs;
+
+    ret = spi_bitbang_start(&bb->bitbang);
+    if (ret)
+        goto err_master;
+
+    // Minor N of the character device talks to chip-select N; a client driver may bind to
+    // the devices as well. spi_setup() refuses a device with both DUAL and QUAD bits, and a
+    // QUAD device may still run 2-bit transfers, so the devices get only the widest mode.
+    strscpy(info.modalias, modalias ? modalias : DRIVER_NAME, sizeof(info.modalias));
+    for (i = 0; i < num_cs; i++) {
+        info.chip_select = i;
+        info.mode = cs_modes[i] | (quad ? SPI_TX_QUAD | SPI_RX_QUAD : SPI_TX_DUAL | SPI_RX_DUAL);
+        info.max_speed_hz = cs_speeds[i] ? cs_speeds[i] : speed_hz;
+        bb->spi[i] = spi_new_device(master, &info);
+        if (!bb->spi[i]) {
+            ret = -ENODEV;
+            goto err_bitbang;  // Also removes the devices added so far
+        }
+    }
+
+    // Best effort, the bus works without it
+    spi_debugfs = debugfs_create_dir(DRIVER_NAME, NULL);
+    debugfs_create_file("stats", 0444, spi_debugfs, NULL, &spi_bb_stats_fops);
+    debugfs_create_file("clock", 0444, spi_debugfs, NULL, &spi_bb_clock_fops);
+
+    pr_info("SPI bus %d on GPIOs (MOSI %d, MISO %d, SCK %d, %d chip-selects), %u Hz, %s backend, %s I/O\n",
+            master->bus_num, GPIO_MOSI, GPIO_MISO, GPIO_SCK, num_cs, speed_hz,
+            spi_bb_backend_names[backend], quad ? "quad" : "dual");
+    return 0;
+
+err_bitbang:
+    spi_bitbang_stop(&bb->bitbang);  // Drops only the reference the registration took
+err_master:
+    spi_master_put(master);
+err_pdev:
+    platform_device_unregister(pdev);
+    if (regs.base)
+        iounmap(regs.base);
+    return ret;
+}
+
+// Unregister the controller; this also removes the chip-select devices
+static void spi_bb_unregister(void)
+{
+    struct platform_device *pdev = bb->pdev;
+    struct spi_master *master = bb->bitbang.master;
+
+    debugfs_remove_recursive(spi_debugfs);
+    spi_bitbang_stop(&bb->bitbang);  // Drops only the reference the registration took
+    bb = NULL;
+    spi_master_put(master);          // The one from spi_alloc_master(); frees bb with it
+    platform_device_unregister(pdev);
+    if (regs.base)
+        iounmap(regs.base);
+}
+
 // Module initialization function (called when the module is loaded)
 static int __init spi_master_init(void)
-{ 
-    // Register the character device with a dynamically allocated major number
-    major = register_chrdev(0, "SPI_MASTER", &fops);  
-    pr_info("Registered with major number %d\n", major);  // Log the major number
+{
+    int i, ret;
+
+    if (!queue_depth || (io2_gpio < 0) != (io3_gpio < 0) || num_cs < 1)
+        return -EINVAL;
+    lane_gpio[2] = io2_gpio;
+    lane_gpio[3] = io3_gpio;
 
     pr_info("Initializing SPI Master (Bit-banging)\n");
 
-    // Request GPIOs for MOSI, MISO, SCK, and CS pins
-    if (gpio_request(GPIO_MOSI, "MOSI") ||
-        gpio_request(GPIO_MISO, "MISO") ||
-        gpio_request(GPIO_SCK, "SCK") ||
-        gpio_request(GPIO_CS, "CS")) {
-        pr_err("Failed to request GPIOs\n");  // Log an error if GPIO request fails
-        return -EBUSY;  // Return error if GPIO request fails
+    // Request GPIOs for MOSI, MISO, SCK, and the CS pins
+    ret = gpio_request(GPIO_MOSI, "MOSI");
+    if (ret)
+        goto err_gpio;
+    ret = gpio_request(GPIO_MISO, "MISO");
+    if (ret)
+        goto err_mosi;
+    ret = gpio_request(GPIO_SCK, "SCK");
+    if (ret)
+        goto err_miso;
+    for (i = 0; i < num_cs; i++) {
+        ret = gpio_request(cs_gpios[i], "CS");
+        if (ret)
+            goto err_cs;
+    }
+    if (io2_gpio >= 0) {
+        ret = gpio_request(io2_gpio, "IO2");
+        if (ret)
+            goto err_cs;
+        ret = gpio_request(io3_gpio, "IO3");
+        if (ret)
+            goto err_io2;
+        gpio_direction_output(io2_gpio, 1);  // Inactive WP#/HOLD# until a quad transfer
+        gpio_direction_output(io3_gpio, 1);
     }
 
     // Configure GPIO directions (output for MOSI, SCK, CS; input for MISO)
     gpio_direction_output(GPIO_MOSI, 0);  // Set MOSI pin as output, initial value is 0
     gpio_direction_input(GPIO_MISO);      // Set MISO pin as input (receive data from slave)
     gpio_direction_output(GPIO_SCK, 0);   // Set SCK pin as output, initial value is 0
-    gpio_direction_output(GPIO_CS, 1);    // Set CS pin as output, initial value is 1 (inactive)
+    for (i = 0; i < num_cs; i++)          // Set CS pins as outputs, inactive
+        gpio_direction_output(cs_gpios[i], !(cs_modes[i] & SPI_CS_HIGH));
+
+    // Hand the lines to the SPI core
+    ret = spi_bb_register();
+    if (ret) {
+        pr_err("Failed to register the SPI controller\n");
+        goto err_io3;
+    }
+
+    // Writes are clocked out by the pump
+    ret = spi_bb_pump_start();
+    if (ret) {
+        pr_err("Failed to start the transfer pump\n");
+        goto err_bb;
+    }
+
+    // Register the character device last: its file operations need bb and the pump
+    major = register_chrdev(0, "SPI_MASTER", &fops);
+    if (major < 0) {
+        ret = major;
+        goto err_pump;
+    }
+    pr_info("Registered with major number %d\n", major);  // Log the major number
 
     pr_info("SPI Master Initialized\n");
 
     return 0;  // Return success
+
+err_pump:
+    spi_bb_pump_stop();
+err_bb:
+    spi_bb_unregister();
+err_io3:
+    if (io3_gpio >= 0)
+        gpio_free(io3_gpio);
+err_io2:
+    if (io2_gpio >= 0)
+        gpio_free(io2_gpio);
+    i = num_cs;
+err_cs:
+    while (i--)
+        gpio_free(cs_gpios[i]);
+    gpio_free(GPIO_SCK);
+err_miso:
+    gpio_free(GPIO_MISO);
+err_mosi:
+    gpio_free(GPIO_MOSI);
+err_gpio:
+    pr_err("SPI Master initialization failed\n");
+    return ret;
 }
 
 // Module cleanup function (called when the module is unloaded)
 static void __exit spi_master_exit(void)
 {
+    int i;
+
+    // Unregister the character device first, so no new writes reach the pump
+    unregister_chrdev(major, "SPI_MASTER");
+
+    // Stop the pump, then the controller before its lines go away
+    spi_bb_pump_stop();
+    spi_bb_unregister();
+
     // Free the GPIOs that were previously requested
     gpio_free(GPIO_MOSI);
     gpio_free(GPIO_MISO);
     gpio_free(GPIO_SCK);
-    gpio_free(GPIO_CS);
-
-    // Unregister the character device
-    unregister_chrdev(major, "SPI_MASTER");
+    for (i = 0; i < num_cs; i++)
+        gpio_free(cs_gpios[i]);
+    if (io2_gpio >= 0) {
+        gpio_free(io2_gpio);
+        gpio_free(io3_gpio);
+    }
 
     pr_info("SPI Master Exited\n");  // Log that the module has exited
 }
@@ -204,4 +1706,3 @@ module_exit(spi_master_exit);   // Call spi_master_exit when the module is unloa
 MODULE_LICENSE("GPL");               // Specify the license type for the module
 MODULE_AUTHOR("TEAM 1 & 7");            // Author's name
 MODULE_DESCRIPTION("SPI Master using Bit-banging for Raspberry Pi");  // Module description
-
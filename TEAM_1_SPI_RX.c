@@ -7,16 +7,47 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/cdev.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/bitops.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/overflow.h>
+#include <linux/log2.h>
+#include "spi_slave_capture.h"
 
 // Pseudo Code for the Module Initialization and Setup:
 // 1. Define GPIO pin numbers for SPI signals (MOSI, MISO, SCLK, CS)
-// 2. Declare tasklet for SPI data transfer simulation
+// 2. Declare the bit capture: SCLK polled from a tasklet (softirq, the original method), from
+//    the threaded CS interrupt or from a SCHED_FIFO sampler thread bound to sample_cpu, or driven
+//    by SCLK edge interrupts (module parameter capture); or, as a passive logic analyzer, record
+//    every CS, SCLK and MOSI transition in a ring and decode the frames from the recording
 // 3. Define buffers for received and transmitted data
-// 4. Implement SPI open, close, and read functions
+// 4. Implement SPI open, close, read and poll functions; every CS-delimited frame is queued
+//    and read() returns one frame per call, sleeping until one arrives (EAGAIN for O_NONBLOCK);
+//    write() stages the response for the next frame in a back buffer, swapped in at CS assertion
 // 5. Implement CS interrupt handler to start/stop SPI communication
-// 6. Implement the SPI emulation logic using GPIO pins
+// 6. Implement the SPI emulation logic using GPIO pins, for SPI modes 0-3, MSB or LSB first,
+//    4 to 32 bit words (module parameters mode, lsb_first, bits_per_word)
 // 7. Implement module initialization (allocating device numbers, configuring GPIOs, registering IRQ)
 // 8. Implement module cleanup (free resources like GPIOs, IRQ, and device number)
+// 9. Report the capture statistics in debugfs spi_slave_emulation/stats: the fastest master
+//    clock received without errors, the time the capture kept softirqs or hard IRQs waiting, its
+//    CPU usage and, once the expected frame is written to spi_slave_emulation/expect, the bit
+//    error rate
+// 10. Logic analyzer: read the recorded transitions from debugfs spi_slave_emulation/capture
+//    (records in spi_slave_capture.h), or their replay through the decoder, with the master's
+//    clock period and jitter, from spi_slave_emulation/decode
 
 #define DRIVER_NAME "spi_slave_emulation"
 #define GPIO_MOSI 535  // GPIO Pin for Master Out Slave In (MOSI)
@@ -25,22 +56,109 @@
 #define GPIO_CS   520  // GPIO Pin for Chip Select (CS), GPIO 8
 #define GPIO_LED  529  // GPIO Pin for LED, used for indicating activity
 
+// Frame format, must match the master's
+static int mode;                          // SPI mode 0-3 (bit 1 = CPOL, bit 0 = CPHA)
+module_param(mode, int, 0444);
+MODULE_PARM_DESC(mode, "SPI mode 0-3 (CPOL/CPHA)");
+static bool lsb_first;                    // Least significant bit first
+module_param(lsb_first, bool, 0444);
+MODULE_PARM_DESC(lsb_first, "Shift words LSB first");
+static unsigned int bits_per_word = 8;    // Word size in bits
+module_param(bits_per_word, uint, 0444);
+MODULE_PARM_DESC(bits_per_word, "Word size, 4 to 32 bits (stored in 1, 2 or 4 bytes)");
+
+// How the bits are captured
+enum { SPI_CAPTURE_TASKLET, SPI_CAPTURE_THREAD, SPI_CAPTURE_EDGE, SPI_CAPTURE_SAMPLER, SPI_CAPTURE_ANALYZER };
+static const char * const capture_names[] = { "tasklet", "thread", "edge", "sampler", "analyzer" };
+static int capture = SPI_CAPTURE_THREAD;
+module_param(capture, int, 0444);
+MODULE_PARM_DESC(capture, "Bit capture: 0 = tasklet polling SCLK (softirq), 1 = threaded CS IRQ polling SCLK, 2 = SCLK edge interrupts, 3 = SCHED_FIFO thread polling CS and SCLK, 4 = logic analyzer (MISO not driven)");
+
+static int sample_cpu = -1;  // Required for the sampler, which takes the whole CPU
+module_param(sample_cpu, int, 0444);
+MODULE_PARM_DESC(sample_cpu, "CPU the sampler thread (capture=3) is bound to and keeps busy, best one kept free with isolcpus= (required for capture=3)");
+
+static unsigned int analyzer_samples = 1 << 18;
+module_param(analyzer_samples, uint, 0444);
+MODULE_PARM_DESC(analyzer_samples, "Transitions the logic analyzer (capture=4) keeps, rounded up to a power of two");
+
 // Declare the tasklet for SPI transfer emulation
 static void spi_emulate_transfer(struct tasklet_struct *spi);
 
 // IRQ and flags for SPI communication
 static int cs_irq;
+static int sclk_irq = -1;                 // Edge capture only
 static volatile bool spi_active = false;
+static unsigned int poll_us = 1;          // SCLK poll interval, 0 = spin (threaded capture)
+static struct task_struct *sampler_task;  // Sampler capture only
+static u64 loaded_ns;                     // Load time, for the CPU usage
+static struct spi_la_record *la_ring;     // Analyzer capture only, the latest transitions
+static unsigned int la_mask;              // Ring size - 1
+
+// Capture statistics, for comparing the capture methods (spi_lock)
+struct spi_slave_stats {
+    u64 frames;          // CS assertions handled
+    u64 words;           // Complete words received
+    u64 cut_words;       // Words cut short by CS: clock edges were missed (or extra)
+    u64 edges;           // SCLK interrupts taken (edge capture)
+    u64 dropped;         // Frames lost because the frame queue was full
+    u32 last_hz;         // SCLK rate of the last frame, from its first to its last sample
+    u32 max_clean_hz;    // Fastest frame without cut words: the fastest reliable master clock
+    u64 softirq_max_ns;  // Longest capture run in softirq context (tasklet capture)
+    u64 hardirq_max_ns;  // Longest SCLK interrupt (edge capture)
+    u64 busy_ns;         // CPU time spent capturing (the sampler keeps its CPU busy all the time)
+    u64 bits_checked;    // Bits compared with the expected frame
+    u64 bit_errors;      // Bits that differed from it, or were missing
+    u64 la_dropped;      // Transitions not recorded while the analyzer ring was being read
+};
+
+// Frame in progress for the edge capture (spi_lock)
+struct spi_edge_frame {
+    unsigned int byte_idx;   // Next word's place in the buffers
+    unsigned int bit;        // Bits of the current word done
+    u32 tx, word;            // Word going out and word coming in
+    unsigned int samples;    // Sampling edges in the frame
+    u64 first_ns, last_ns;   // First and last sampling edge
+};
 
-// Monitoring flag to track if data has been received
-int monitoring_flag = 0;
+static DEFINE_SPINLOCK(spi_lock);         // Protects stats, edge_frame and expect
+static struct spi_slave_stats stats;
+static struct spi_edge_frame edge_frame;
+static char expect[32];                   // Frame the master is expected to send, for the BER
+static unsigned int expect_len;           // 0: no bit error counting
+static u64 la_head;                       // Transitions recorded so far
+static unsigned int la_paused;            // Open capture and decode files; recording pauses
+static struct dentry *spi_debugfs;        // debugfs spi_slave_emulation directory
 
 // Tasklet declaration for SPI data transfer emulation
 DECLARE_TASKLET(spi_tasklet, spi_emulate_transfer);
 
 // Buffers for storing received and transmitted data
-static char rx_buffer[32];  // Buffer for received data (max 32 bytes)
-static char tx_buffer[32] = "Response from SPI Slave";  // Buffer for data to send back (default response)
+static char rx_buffer[32] __aligned(4);  // Buffer for received data (max 32 bytes)
+
+// Response double buffer: the capture reads the front buffer without locking, write() fills the
+// back one and the CS interrupt swaps them (spi_lock) before the frame's first bit goes out
+static char tx_bufs[2][32] __aligned(4) = { "Response from SPI Slave" };  // Default response first
+static char *tx_buffer = tx_bufs[0];  // Response going out in the current frame
+static char *tx_back = tx_bufs[1];    // Response staged by write() for the next frame
+static bool tx_staged;                // tx_back holds a response that was not sent yet
+
+// Received frames waiting for read(), one per CS assertion
+#define SPI_FRAME_QUEUE 16  // Frames, a power of two
+
+struct spi_frame {
+    u8 len;                        // Bytes received
+    char data[sizeof(rx_buffer)];
+};
+
+// One producer (the capture, one frame at a time), readers serialized by spi_read_lock
+static DEFINE_KFIFO(spi_frames, struct spi_frame, SPI_FRAME_QUEUE);
+static DECLARE_WAIT_QUEUE_HEAD(spi_wait);  // Readers waiting for a frame
+static DEFINE_MUTEX(spi_read_lock);
+
+// Character device, must outlive spi_slave_init()
+static dev_t spi_dev;
+static struct cdev spi_cdev;
 
 // Pseudo Code for SPI open function:
 // 1. Log a message when the device is opened
@@ -62,138 +180,947 @@ static int spi_close(struct inode *inode, struct file *file)
     return 0;  // Return success
 }
 
+static void spi_edge_start(void);
+static void spi_edge_end(void);
+
+// Make the staged response the current one; the master has not clocked any bit of the frame yet
+static void spi_tx_swap(void)
+{
+    unsigned long flags;
+    char *front;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    if (tx_staged) {
+        front = tx_buffer;
+        tx_buffer = tx_back;
+        tx_back = front;
+        tx_staged = false;
+    }
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
+
 // Pseudo Code for Chip Select (CS) IRQ Handler:
 // 1. Check the current state of the Chip Select (CS) pin.
 // 2. Toggle the SPI active state based on CS value.
-// 3. If CS is active, schedule the SPI data transfer tasklet.
+// 3. If CS is active, swap in the response staged by write(), then start the capture: schedule
+//    the tasklet, wake the IRQ thread, or arm the SCLK edge state machine.
+// 4. If CS is released during edge capture, close the frame.
 
 static irqreturn_t cs_irq_handler(int irq, void *dev_id)
 {
     // Toggle the SPI activity based on CS pin state
     spi_active = !gpio_get_value(GPIO_CS);
+    if (spi_active)
+        spi_tx_swap();
 
-    // If CS is active, schedule the tasklet for data transfer
-    if (spi_active) {
-        tasklet_schedule(&spi_tasklet);  // Schedule SPI data transfer tasklet
-        pr_info("SPI communication started\n");
-    } else {
-        pr_info("SPI communication ended\n");
+    if (capture == SPI_CAPTURE_EDGE) {
+        if (spi_active)
+            spi_edge_start();
+        else
+            spi_edge_end();
+        return IRQ_HANDLED;
     }
 
+    if (!spi_active)
+        return IRQ_HANDLED;  // The polling loop notices and stops
+    if (capture == SPI_CAPTURE_THREAD)
+        return IRQ_WAKE_THREAD;  // Poll in cs_irq_thread, outside softirq context
+    tasklet_schedule(&spi_tasklet);  // Schedule SPI data transfer tasklet
     return IRQ_HANDLED;  // Return interrupt handled status
 }
 
-// Pseudo Code for SPI Data Transfer Emulation:
-// 1. Continuously monitor the SCLK pin for clock edges.
-// 2. On the falling edge, read one bit from MOSI and store it in a byte.
-// 3. On the rising edge, send one bit from the response buffer to MISO.
-// 4. Repeat until all data is received and transmitted.
-static void spi_emulate_transfer(struct tasklet_struct *spi)
+// Pseudo Code for SPI Word Transfer:
+// 1. Put the next bit of the response on MISO on the edge where the data changes
+//    (for CPHA=0 that is before the first clock edge and after every trailing edge).
+// 2. On the sampling edge, shift the MOSI bit into the received word.
+// 3. Repeat for every bit of the word, MSB or LSB first.
+// 4. Give up if the master releases CS in the middle of the word.
+// Every mode and bit order gets its own copy of the loop, so no mode test is left per bit; the
+// sampler thread gets copies of its own as well.
+
+// The sampler gives up on a word that has not completed this long after its first clock read,
+// rather than spinning with preemption off until the master goes on. A 32-bit word needs a
+// clock above 3.2 kHz to fit, slower than any worth a sampler.
+#define SPI_SAMPLER_STALL_NS (10 * NSEC_PER_MSEC)
+
+// Sampler only: SCLK polls and deadline of the word in progress
+struct spi_sample_clock {
+    unsigned int polls;
+    u64 deadline;  // 0 until the clock was first read
+};
+
+// Poll SCLK until it reaches the given level; false if the master released CS first. The
+// sampler has no CS interrupt and reads the pin itself, must not hang an unload and looks at
+// the clock only every few hundred polls of the word, so a running master costs no time reads.
+static __always_inline bool spi_wait_sclk(int level, const int sampler, struct spi_sample_clock *clk)
+{
+    u64 now;
+
+    while (gpio_get_value(GPIO_SCLK) != level) {
+        if (sampler ? gpio_get_value(GPIO_CS) || kthread_should_stop() : !spi_active)
+            return false;
+        if (sampler) {
+            if (!(++clk->polls & 255)) {
+                now = ktime_get_ns();
+                if (!clk->deadline)
+                    clk->deadline = now + SPI_SAMPLER_STALL_NS;
+                else if (now > clk->deadline)
+                    return false;  // The frame counts as cut
+            }
+            cpu_relax();
+        } else if (poll_us) {
+            udelay(poll_us);  // Small delay to avoid busy-waiting
+        } else {
+            cpu_relax();      // Own thread: spin for the shortest reaction time
+        }
+    }
+    return true;
+}
+
+static __always_inline int spi_xfer_bits(u32 tx, u8 bits, u32 *rx, const int cpol, const int cpha, const int lsb,
+                                         const int sampler, struct spi_sample_clock *clk)
+{
+    u32 word = 0;
+    int i;
+
+    for (i = 0; i < bits; i++) {
+        int shift = lsb ? i : bits - 1 - i;  // Position of the bit going out and coming in
+
+        // CPHA=1: data changes on the leading edge
+        if (cpha && !spi_wait_sclk(!cpol, sampler, clk))
+            return -EIO;
+        gpio_set_value(GPIO_MISO, (tx >> shift) & 0x01);
+
+        // Sampling edge: leading for CPHA=0, trailing for CPHA=1
+        if (!spi_wait_sclk(cpha ? cpol : !cpol, sampler, clk))
+            return -EIO;
+        word |= (u32)!!gpio_get_value(GPIO_MOSI) << shift;
+
+        // CPHA=0: the next bit goes out after the trailing edge
+        if (!cpha && !spi_wait_sclk(cpol, sampler, clk))
+            return -EIO;
+    }
+
+    *rx = word;
+    return 0;
+}
+
+// The sampler runs each word with preemption off, so nothing but interrupts gets between two
+// SCLK edges, and lets the scheduler (watchdogs, RCU) in between words. The deadline covers the
+// whole word, so preemption stays off for at most the word's bits at the master's clock, or
+// SPI_SAMPLER_STALL_NS plus 256 SCLK polls when the master stops clocking in the middle of it.
+#define SPI_XFER_WORD(name, cpol, cpha, lsb, sampler)                   \
+static int name(u32 tx, u8 bits, u32 *rx)                               \
+{                                                                       \
+    struct spi_sample_clock clk = { 0 };                                \
+    int ret;                                                            \
+                                                                        \
+    if (sampler)                                                        \
+        preempt_disable();                                              \
+    ret = spi_xfer_bits(tx, bits, rx, cpol, cpha, lsb, sampler, &clk);  \
+    if (sampler) {                                                      \
+        preempt_enable();                                               \
+        cond_resched();                                                 \
+    }                                                                   \
+    return ret;                                                         \
+}
+
+SPI_XFER_WORD(spi_xfer_mode0, 0, 0, 0, 0)
+SPI_XFER_WORD(spi_xfer_mode1, 0, 1, 0, 0)
+SPI_XFER_WORD(spi_xfer_mode2, 1, 0, 0, 0)
+SPI_XFER_WORD(spi_xfer_mode3, 1, 1, 0, 0)
+SPI_XFER_WORD(spi_xfer_mode0_lsb, 0, 0, 1, 0)
+SPI_XFER_WORD(spi_xfer_mode1_lsb, 0, 1, 1, 0)
+SPI_XFER_WORD(spi_xfer_mode2_lsb, 1, 0, 1, 0)
+SPI_XFER_WORD(spi_xfer_mode3_lsb, 1, 1, 1, 0)
+SPI_XFER_WORD(spi_sample_mode0, 0, 0, 0, 1)
+SPI_XFER_WORD(spi_sample_mode1, 0, 1, 0, 1)
+SPI_XFER_WORD(spi_sample_mode2, 1, 0, 0, 1)
+SPI_XFER_WORD(spi_sample_mode3, 1, 1, 0, 1)
+SPI_XFER_WORD(spi_sample_mode0_lsb, 0, 0, 1, 1)
+SPI_XFER_WORD(spi_sample_mode1_lsb, 0, 1, 1, 1)
+SPI_XFER_WORD(spi_sample_mode2_lsb, 1, 0, 1, 1)
+SPI_XFER_WORD(spi_sample_mode3_lsb, 1, 1, 1, 1)
+
+// Word loops indexed by capture (sampler thread or not), bit order and SPI mode
+static int (* const spi_xfer_words[2][2][4])(u32 tx, u8 bits, u32 *rx) = {
+    {
+        { spi_xfer_mode0, spi_xfer_mode1, spi_xfer_mode2, spi_xfer_mode3 },
+        { spi_xfer_mode0_lsb, spi_xfer_mode1_lsb, spi_xfer_mode2_lsb, spi_xfer_mode3_lsb },
+    },
+    {
+        { spi_sample_mode0, spi_sample_mode1, spi_sample_mode2, spi_sample_mode3 },
+        { spi_sample_mode0_lsb, spi_sample_mode1_lsb, spi_sample_mode2_lsb, spi_sample_mode3_lsb },
+    },
+};
+
+static int (*spi_xfer_word)(u32 tx, u8 bits, u32 *rx);  // Picked at load time
+
+// Words occupy 1, 2 or 4 bytes of the buffers, like with spidev
+static unsigned int spi_word_bytes(void)
+{
+    return bits_per_word <= 8 ? 1 : bits_per_word <= 16 ? 2 : 4;
+}
+
+static u32 spi_get_word(const char *p, unsigned int bytes)
+{
+    if (bytes == 1)
+        return *(const u8 *)p;
+    if (bytes == 2)
+        return *(const u16 *)p;
+    return *(const u32 *)p;
+}
+
+static void spi_put_word(char *p, unsigned int bytes, u32 word)
+{
+    if (bytes == 1)
+        *(u8 *)p = word;
+    else if (bytes == 2)
+        *(u16 *)p = word;
+    else
+        *(u32 *)p = word;
+}
+
+// Count a finished frame; span_bits bits were sampled in span_ns
+static void spi_account_frame(unsigned int words, bool cut, u64 span_bits, u64 span_ns, u64 busy_ns)
+{
+    unsigned long flags;
+    u32 hz = 0;
+
+    if (span_bits && span_ns)
+        hz = div64_u64(span_bits * NSEC_PER_SEC, span_ns);
+
+    spin_lock_irqsave(&spi_lock, flags);
+    stats.frames++;
+    stats.words += words;
+    stats.cut_words += cut;
+    stats.busy_ns += busy_ns;
+    if (hz) {
+        stats.last_hz = hz;
+        if (!cut && hz > stats.max_clean_hz)
+            stats.max_clean_hz = hz;
+    }
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
+
+// Compare the frame with the expected one; missing bytes count as wrong bits, extra ones are ignored
+// (spi_lock held)
+static void spi_check_frame(const char *data, unsigned int len)
 {
-    int byte_idx = 0;
-    int bit_idx = 0;
-    char received_byte = 0;
+    unsigned int i, errors = 0;
 
-    while (spi_active) {
-        // Wait for clock falling edge (polling SCLK)
-        while (gpio_get_value(GPIO_SCLK) && spi_active)
-            udelay(1);  // Small delay to avoid busy-waiting
+    if (!expect_len)
+        return;
+    for (i = 0; i < expect_len; i++)
+        errors += i < len ? hweight8((u8)(data[i] ^ expect[i])) : 8;
+    stats.bits_checked += expect_len * 8;
+    stats.bit_errors += errors;
+}
+
+// Hand a finished frame to the readers; frames without a complete word are not queued. Each
+// capture has one producer at a time, except the analyzer, where any of its three interrupts
+// (on any CPU) can close a frame; kfifo_put() is only safe for one producer, so the copy and
+// the put happen under spi_lock. Readers take frames out under spi_read_lock.
+static void spi_queue_frame(const char *data, unsigned int len)
+{
+    struct spi_frame frame;
+    unsigned long flags;
+    bool queued = false;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    spi_check_frame(data, len);
+    if (len) {
+        frame.len = len;
+        memcpy(frame.data, data, len);
+        queued = kfifo_put(&spi_frames, frame);
+        if (!queued)
+            stats.dropped++;  // Nobody has read for SPI_FRAME_QUEUE frames
+    }
+    spin_unlock_irqrestore(&spi_lock, flags);
+
+    if (queued)
+        wake_up_interruptible(&spi_wait);
+}
+
+// Pseudo Code for SPI Data Transfer Emulation (polling SCLK):
+// 1. While CS is held, exchange one word after the other with the master.
+// 2. Send the response from tx_buffer and store what the master sent in rx_buffer.
+// 3. Stop when CS is released or the receive buffer is full.
+// 4. Derive the master's clock from the time between the end of the first and the last word.
+// 5. Queue the frame for read().
+static void spi_poll_frame(void)
+{
+    unsigned int bytes = spi_word_bytes();
+    const char *tx = READ_ONCE(tx_buffer);  // Swapped only at CS assertion, before this frame
+    unsigned int byte_idx = 0, words = 0;
+    u64 start = ktime_get_ns(), first = 0, last = 0;
+    bool cut = false;
+    u32 word;
 
-        // Break if SPI communication is stopped
-        if (!spi_active)
+    while (spi_active && byte_idx + bytes <= sizeof(rx_buffer)) {
+        if (spi_xfer_word(spi_get_word(tx + byte_idx, bytes), bits_per_word, &word)) {
+            cut = true;  // CS was released in the middle of a word
             break;
+        }
+
+        spi_put_word(rx_buffer + byte_idx, bytes, word);  // Store received word
+        last = ktime_get_ns();
+        if (!words++)
+            first = last;
+        pr_debug("Received Word: 0x%0*x\n", bytes * 2, word);  // Log received word
+        byte_idx += bytes;  // Move to the next word
+    }
 
-        // Read one bit from MOSI and shift it into the received byte
-        int mosi_bit = gpio_get_value(GPIO_MOSI);
-        received_byte = (received_byte << 1) | mosi_bit;
+    spi_account_frame(words, cut, (u64)(words - !!words) * bits_per_word, last - first,
+                      ktime_get_ns() - start);
+    spi_queue_frame(rx_buffer, byte_idx);
+}
 
-        // Send one bit from the response buffer (MISO)
-        int miso_bit = (tx_buffer[byte_idx] >> (7 - bit_idx)) & 0x01;
-        gpio_set_value(GPIO_MISO, miso_bit);
+// Original capture: poll the whole frame from the tasklet, with softirqs held off meanwhile
+static void spi_emulate_transfer(struct tasklet_struct *spi)
+{
+    u64 start = ktime_get_ns(), ns;
+    unsigned long flags;
 
-        bit_idx++;  // Move to the next bit position
+    spi_poll_frame();
 
-        // If all 8 bits are received, store the byte in the receive buffer
-        if (bit_idx == 8) {
-            rx_buffer[byte_idx] = received_byte;  // Store received byte
-            pr_info("Received Byte: 0x%02x\n", received_byte);  // Log received byte
-            received_byte = 0;  // Reset byte accumulator
-            bit_idx = 0;  // Reset bit index
-            byte_idx++;  // Move to the next byte
+    ns = ktime_get_ns() - start;
+    spin_lock_irqsave(&spi_lock, flags);
+    stats.softirq_max_ns = max(stats.softirq_max_ns, ns);
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
 
-            if (byte_idx >= sizeof(rx_buffer))  // Stop if buffer is full
-                break;
+// Threaded capture: poll the frame in the CS interrupt's thread, a SCHED_FIFO task that
+// softirqs and other interrupts can preempt
+static irqreturn_t cs_irq_thread(int irq, void *dev_id)
+{
+    if (spi_active)
+        spi_poll_frame();
+    return IRQ_HANDLED;
+}
+
+// Pseudo Code for the Sampler Thread (SCHED_FIFO, bound to sample_cpu):
+// 1. Spin on the CS pin; between polls let other threads of the same priority run.
+// 2. At CS assertion swap in the staged response and capture the frame, each word with
+//    preemption off (the spi_sample_* word loops); a word on which SCLK stands still for
+//    SPI_SAMPLER_STALL_NS ends the frame as cut.
+// 3. Wait for CS release (the receive buffer may have filled first).
+// Reacting within a few hundred nanoseconds costs a whole CPU, idle CS included, so the mode
+// needs sample_cpu: keep it free of other work and interrupts (isolcpus=, irqaffinity=), and
+// allow SCHED_FIFO to use all of it (sched_rt_runtime_us = -1), or the throttling stalls the
+// sampler for part of each second. Anything left on that CPU only runs when throttling lets it.
+static int spi_sampler(void *data)
+{
+    while (!kthread_should_stop()) {
+        if (gpio_get_value(GPIO_CS)) {
+            cond_resched();
+            cpu_relax();
+            continue;
         }
 
-        // Wait for clock rising edge (polling SCLK)
-        while (!gpio_get_value(GPIO_SCLK) && spi_active)
-            udelay(1);  // Small delay to avoid busy-waiting
+        spi_active = true;
+        spi_tx_swap();
+        spi_poll_frame();
+
+        while (!gpio_get_value(GPIO_CS) && !kthread_should_stop())
+            cond_resched();
+        spi_active = false;
+    }
+    return 0;
+}
+
+// Start the sampler, bound to sample_cpu; never on a CPU the scheduler picks, which it would
+// take from whatever else runs there
+static int spi_sampler_start(void)
+{
+    if (sample_cpu < 0 || sample_cpu >= nr_cpu_ids || !cpu_online(sample_cpu)) {
+        pr_err("The sampler needs an online sample_cpu, got %d\n", sample_cpu);
+        return -EINVAL;
+    }
+
+    sampler_task = kthread_create(spi_sampler, NULL, "spi_slave_sampler");
+    if (IS_ERR(sampler_task))
+        return PTR_ERR(sampler_task);
+    kthread_bind(sampler_task, sample_cpu);
+    sched_set_fifo(sampler_task);
+    wake_up_process(sampler_task);
+    return 0;
+}
+
+// Pseudo Code for SPI Edge Capture (SCLK interrupts on both edges):
+// 1. At CS assertion, load the first response word and put its first bit on MISO.
+// 2. On the edge where data changes, put the current bit on MISO.
+// 3. On the sampling edge, shift the MOSI bit into the word; after bits_per_word bits store
+//    it and load the next response word.
+// 4. At CS release, count a partially received word as cut, account and queue the frame.
+// The SCLK level read in the handler tells which edge it was, so a missed edge shows up as a
+// cut word rather than shifting everything after it.
+
+// Bit of the current response word that goes out next
+static void spi_edge_put_miso(void)
+{
+    unsigned int shift = lsb_first ? edge_frame.bit : bits_per_word - 1 - edge_frame.bit;
+
+    gpio_set_value(GPIO_MISO, (edge_frame.tx >> shift) & 0x01);
+}
+
+static void spi_edge_start(void)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    memset(&edge_frame, 0, sizeof(edge_frame));
+    edge_frame.tx = spi_get_word(tx_buffer, spi_word_bytes());
+    spi_edge_put_miso();  // CPHA=0: the first bit is sampled on the first edge
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
+
+static void spi_edge_end(void)
+{
+    struct spi_edge_frame fr;
+    unsigned long flags;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    fr = edge_frame;
+    spin_unlock_irqrestore(&spi_lock, flags);
+
+    spi_account_frame(fr.byte_idx / spi_word_bytes(), fr.bit != 0,
+                      fr.samples ? fr.samples - 1 : 0, fr.last_ns - fr.first_ns, 0);
+    spi_queue_frame(rx_buffer, fr.byte_idx);  // The SCLK handler stopped storing at CS release
+}
+
+static irqreturn_t sclk_irq_handler(int irq, void *dev_id)
+{
+    unsigned int bytes = spi_word_bytes();
+    const int cpol = !!(mode & 0x02), cpha = mode & 0x01;
+    u64 start = ktime_get_ns(), ns;
+    int level = !!gpio_get_value(GPIO_SCLK);  // Level after the edge
+    bool sample = (level != cpol) != cpha;    // Leading edge samples for CPHA=0, trailing for CPHA=1
+
+    spin_lock(&spi_lock);
+    stats.edges++;
+    if (!spi_active || edge_frame.byte_idx + bytes > sizeof(rx_buffer))
+        goto out;  // Not selected, or the buffer is full
+
+    if (!sample) {
+        spi_edge_put_miso();
+        goto out;
+    }
+
+    // Sampling edge: shift in MOSI
+    if (lsb_first)
+        edge_frame.word |= (u32)!!gpio_get_value(GPIO_MOSI) << edge_frame.bit;
+    else
+        edge_frame.word = edge_frame.word << 1 | !!gpio_get_value(GPIO_MOSI);
+    edge_frame.last_ns = start;
+    if (!edge_frame.samples++)
+        edge_frame.first_ns = start;
+
+    if (++edge_frame.bit == bits_per_word) {
+        spi_put_word(rx_buffer + edge_frame.byte_idx, bytes, edge_frame.word);
+        edge_frame.byte_idx += bytes;
+        edge_frame.bit = 0;
+        edge_frame.word = 0;
+        if (edge_frame.byte_idx + bytes <= sizeof(tx_bufs[0]))
+            edge_frame.tx = spi_get_word(tx_buffer + edge_frame.byte_idx, bytes);
+    }
+
+out:
+    ns = ktime_get_ns() - start;
+    stats.hardirq_max_ns = max(stats.hardirq_max_ns, ns);
+    stats.busy_ns += ns;
+    spin_unlock(&spi_lock);
+    return IRQ_HANDLED;
+}
+
+// Pseudo Code for the Logic Analyzer (interrupts on both edges of CS, SCLK and MOSI):
+// 1. On every edge read the three pins and store them with the time in the ring, overwriting
+//    the oldest transition; while the ring is being read out, count the transition as dropped.
+// 2. Feed the transition to the live decoder, which queues each frame for read() at CS release.
+// 3. The decode file replays the ring through a second decoder.
+// The decoder measures the time between sampling edges, i.e. the master's clock period plus
+// the variation of the interrupt latency, including any gaps the master leaves between words.
+// MISO stays an input: the analyzer only listens and can sit on a bus next to the real slave.
+
+// Decoder state, with the module's frame format
+struct spi_la_decoder {
+    bool selected;           // Inside a frame
+    int sclk;                // SCLK level after the last transition
+    unsigned int byte_idx;   // Next word's place in data
+    unsigned int bit;        // Bits of the current word done
+    u32 word;                // Word coming in
+    unsigned int samples;    // Sampling edges in the frame
+    u64 first_ns, last_ns;   // First and last sampling edge
+    char data[sizeof(rx_buffer)] __aligned(4);
+
+    // Time between sampling edges within frames
+    u64 periods, period_sum, period_sq_sum;
+    u64 period_min_ns, period_max_ns;
+};
+
+static struct spi_la_decoder la_live;  // Frames for read() (spi_lock)
+
+static const struct {
+    unsigned int gpio;
+    u8 bit;                  // SPI_LA_*, also the dev_id of the pin's interrupt
+} la_pins[] = {
+    { GPIO_CS, SPI_LA_CS },
+    { GPIO_SCLK, SPI_LA_SCLK },
+    { GPIO_MOSI, SPI_LA_MOSI },
+};
+static int la_irqs[ARRAY_SIZE(la_pins)];
+
+// Feed one transition; true when it closed a frame, whose words are then in dec->data
+static bool spi_la_feed(struct spi_la_decoder *dec, const struct spi_la_record *rec)
+{
+    unsigned int bytes = spi_word_bytes();
+    const int cpol = !!(mode & 0x02), cpha = mode & 0x01;
+    int sclk = !!(rec->levels & SPI_LA_SCLK);
+    u64 period;
+
+    if (!dec->selected) {
+        // A frame starts at the CS edge, not in the middle of one the ring cut off
+        if (rec->pin != SPI_LA_CS || (rec->levels & SPI_LA_CS))
+            return false;
+        dec->selected = true;
+        dec->sclk = sclk;
+        dec->byte_idx = dec->bit = dec->samples = 0;
+        dec->word = 0;
+        return false;
     }
 
-    monitoring_flag = 1;  // Set flag indicating data is available
+    if (rec->levels & SPI_LA_CS) {
+        dec->selected = false;
+        return true;
+    }
+
+    if (sclk == dec->sclk)
+        return false;  // MOSI changed (or an SCLK edge pair was missed)
+    dec->sclk = sclk;
+    if ((sclk != cpol) == cpha || dec->byte_idx + bytes > sizeof(dec->data))
+        return false;  // Not the sampling edge, or the buffer is full
+
+    if (dec->samples++) {
+        period = rec->timestamp_ns - dec->last_ns;
+        if (!dec->periods++ || period < dec->period_min_ns)
+            dec->period_min_ns = period;
+        dec->period_max_ns = max(dec->period_max_ns, period);
+        dec->period_sum += period;
+        dec->period_sq_sum += period * period;
+    } else {
+        dec->first_ns = rec->timestamp_ns;
+    }
+    dec->last_ns = rec->timestamp_ns;
+
+    if (lsb_first)
+        dec->word |= (u32)!!(rec->levels & SPI_LA_MOSI) << dec->bit;
+    else
+        dec->word = dec->word << 1 | !!(rec->levels & SPI_LA_MOSI);
+    if (++dec->bit == bits_per_word) {
+        spi_put_word(dec->data + dec->byte_idx, bytes, dec->word);
+        dec->byte_idx += bytes;
+        dec->bit = 0;
+        dec->word = 0;
+    }
+    return false;
+}
+
+static irqreturn_t spi_la_irq_handler(int irq, void *dev_id)
+{
+    struct spi_la_record rec = {
+        .timestamp_ns = ktime_get_ns(),
+        .pin = (unsigned long)dev_id,
+    };
+    struct spi_la_decoder fr;
+    bool done;
+    u64 ns;
+
+    rec.levels = (gpio_get_value(GPIO_CS) ? SPI_LA_CS : 0) |
+                 (gpio_get_value(GPIO_SCLK) ? SPI_LA_SCLK : 0) |
+                 (gpio_get_value(GPIO_MOSI) ? SPI_LA_MOSI : 0);
+
+    spin_lock(&spi_lock);
+    stats.edges++;
+    if (la_paused)
+        stats.la_dropped++;
+    else
+        la_ring[la_head++ & la_mask] = rec;
+
+    done = spi_la_feed(&la_live, &rec);
+    if (done)
+        fr = la_live;  // The next transition may start another frame in la_live
+
+    ns = ktime_get_ns() - rec.timestamp_ns;
+    stats.hardirq_max_ns = max(stats.hardirq_max_ns, ns);
+    stats.busy_ns += ns;
+    spin_unlock(&spi_lock);
+
+    if (done) {
+        spi_account_frame(fr.byte_idx / spi_word_bytes(), fr.bit != 0,
+                          fr.samples ? fr.samples - 1 : 0, fr.last_ns - fr.first_ns, 0);
+        spi_queue_frame(fr.data, fr.byte_idx);
+    }
+    return IRQ_HANDLED;
+}
+
+// Allocate the ring and listen on the three pins
+static int spi_la_start(void)
+{
+    unsigned int n = roundup_pow_of_two(max(analyzer_samples, 2u));
+    int i, ret;
+
+    la_ring = vmalloc(array_size(n, sizeof(*la_ring)));
+    if (!la_ring)
+        return -ENOMEM;
+    la_mask = n - 1;
+
+    gpio_direction_input(GPIO_MISO);  // Listen only
+
+    for (i = 0; i < ARRAY_SIZE(la_pins); i++) {
+        la_irqs[i] = gpio_to_irq(la_pins[i].gpio);
+        ret = la_irqs[i] < 0 ? la_irqs[i] :
+              request_irq(la_irqs[i], spi_la_irq_handler, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                          DRIVER_NAME "_la", (void *)(unsigned long)la_pins[i].bit);
+        if (ret)
+            goto err_irq;
+    }
+    return 0;
+
+err_irq:
+    while (i--)
+        free_irq(la_irqs[i], (void *)(unsigned long)la_pins[i].bit);
+    vfree(la_ring);
+    return ret;
+}
+
+static void spi_la_stop(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(la_pins); i++)
+        free_irq(la_irqs[i], (void *)(unsigned long)la_pins[i].bit);
+    vfree(la_ring);
+}
+
+// Stop recording while the ring is read out; returns the first and the end transition kept
+static void spi_la_pause(u64 *oldest, u64 *head)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    la_paused++;
+    *head = la_head;
+    *oldest = la_head > la_mask ? la_head - la_mask - 1 : 0;
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
+
+static void spi_la_resume(void)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    la_paused--;
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
+
+static void spi_la_show_clock(struct seq_file *m, const struct spi_la_decoder *dec)
+{
+    u64 avg = 0, var = 0;
+
+    if (dec->periods) {
+        avg = div64_u64(dec->period_sum, dec->periods);
+        var = div64_u64(dec->period_sq_sum, dec->periods);
+        var = var > avg * avg ? var - avg * avg : 0;
+    }
+    seq_printf(m, "clk_periods: %llu\nclk_period_min_ns: %llu\nclk_period_avg_ns: %llu\n",
+               dec->periods, dec->period_min_ns, avg);
+    seq_printf(m, "clk_period_max_ns: %llu\nclk_jitter_rms_ns: %llu\n",
+               dec->period_max_ns, (u64)int_sqrt64(var));
+}
+
+// debugfs spi_slave_emulation/capture: the kept transitions as struct spi_la_record, oldest first
+struct spi_la_reader {
+    u64 oldest, head;        // Transitions kept when the file was opened
+};
+
+static int spi_la_capture_open(struct inode *inode, struct file *file)
+{
+    struct spi_la_reader *rd = kmalloc(sizeof(*rd), GFP_KERNEL);
+
+    if (!rd)
+        return -ENOMEM;
+    spi_la_pause(&rd->oldest, &rd->head);
+    file->private_data = rd;
+    return 0;
+}
+
+static ssize_t spi_la_capture_read(struct file *file, char __user *buf, size_t len, loff_t *ppos)
+{
+    const struct spi_la_reader *rd = file->private_data;
+    size_t ring_bytes = (size_t)(la_mask + 1) * sizeof(*la_ring);
+    u64 total = (rd->head - rd->oldest) * sizeof(*la_ring);
+    size_t done = 0, off, n;
+
+    if (*ppos >= total)
+        return 0;
+    len = min_t(u64, len, total - *ppos);
+
+    // The ring is a power of two of records, so the stream position maps to it with a mask
+    while (done < len) {
+        off = (rd->oldest * sizeof(*la_ring) + *ppos + done) & (ring_bytes - 1);
+        n = min(len - done, ring_bytes - off);
+        if (copy_to_user(buf + done, (char *)la_ring + off, n))
+            return -EFAULT;
+        done += n;
+    }
+
+    *ppos += done;
+    return done;
+}
+
+static int spi_la_capture_release(struct inode *inode, struct file *file)
+{
+    kfree(file->private_data);
+    spi_la_resume();
+    return 0;
+}
+
+static const struct file_operations spi_la_capture_fops = {
+    .owner = THIS_MODULE,
+    .open = spi_la_capture_open,
+    .read = spi_la_capture_read,
+    .llseek = default_llseek,
+    .release = spi_la_capture_release,
+};
+
+// debugfs spi_slave_emulation/decode: the kept transitions replayed into frames, then the clock
+static int spi_la_decode_show(struct seq_file *m, void *v)
+{
+    struct spi_la_decoder dec = { 0 };
+    const struct spi_la_record *rec;
+    u64 oldest, head, i;
+
+    spi_la_pause(&oldest, &head);
+    for (i = oldest; i < head; i++) {
+        rec = &la_ring[i & la_mask];
+        if (spi_la_feed(&dec, rec))
+            seq_printf(m, "%llu: %u bytes%s: %*ph\n", rec->timestamp_ns, dec.byte_idx,
+                       dec.bit ? " (cut)" : "", (int)dec.byte_idx, dec.data);
+    }
+    spi_la_resume();
+
+    seq_printf(m, "transitions: %llu\n", head - oldest);
+    spi_la_show_clock(m, &dec);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(spi_la_decode);
+
+// debugfs spi_slave_emulation/stats: compare capture=0 (before) with capture=1 or 2 (after)
+static int spi_stats_show(struct seq_file *m, void *v)
+{
+    u64 up_ns = ktime_get_ns() - loaded_ns;
+    struct spi_la_decoder live;
+    struct spi_slave_stats s;
+    unsigned long flags;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    s = stats;
+    live = la_live;
+    spin_unlock_irqrestore(&spi_lock, flags);
+
+    if (capture == SPI_CAPTURE_SAMPLER)
+        s.busy_ns = up_ns;  // Spins between frames too
+
+    seq_printf(m, "capture: %s\nframes: %llu\nwords: %llu\ncut_words: %llu\nedges: %llu\ndropped: %llu\n",
+               capture_names[capture], s.frames, s.words, s.cut_words, s.edges, s.dropped);
+    seq_printf(m, "last_hz: %u\nmax_clean_hz: %u\n", s.last_hz, s.max_clean_hz);
+    seq_printf(m, "softirq_max_ns: %llu\nhardirq_max_ns: %llu\nbusy_ns: %llu\n",
+               s.softirq_max_ns, s.hardirq_max_ns, s.busy_ns);
+    seq_printf(m, "cpu_permille: %llu\nbits_checked: %llu\nbit_errors: %llu\nber_ppm: %llu\n",
+               up_ns ? div64_u64(s.busy_ns * 1000, up_ns) : 0, s.bits_checked, s.bit_errors,
+               s.bits_checked ? div64_u64(s.bit_errors * 1000000, s.bits_checked) : 0);
+    if (capture == SPI_CAPTURE_ANALYZER) {
+        seq_printf(m, "la_dropped: %llu\n", s.la_dropped);
+        spi_la_show_clock(m, &live);  // Since the module was loaded
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(spi_stats);
+
+// debugfs spi_slave_emulation/expect: the frame the master sends in the test, for the bit
+// error rate; writing it (or nothing, to stop counting) restarts bits_checked and bit_errors
+static ssize_t spi_expect_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos)
+{
+    char data[sizeof(expect)];
+    unsigned long flags;
+
+    len = min(len, sizeof(data));
+    if (copy_from_user(data, buf, len))
+        return -EFAULT;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    memcpy(expect, data, len);
+    expect_len = len;
+    stats.bits_checked = 0;
+    stats.bit_errors = 0;
+    spin_unlock_irqrestore(&spi_lock, flags);
+    return len;
 }
 
+static const struct file_operations spi_expect_fops = {
+    .owner = THIS_MODULE,
+    .write = spi_expect_write,
+};
+
 // Pseudo Code for SPI read function:
-// 1. Check if data has been received (monitoring_flag is set).
-// 2. If data is available, copy the received data from kernel space to user space.
-// 3. Reset the monitoring flag after reading the data.
+// 1. Wait until a frame is queued, or return -EAGAIN for O_NONBLOCK callers.
+// 2. Take the oldest frame off the queue.
+// 3. Copy it to user space and return its length; bytes beyond len are discarded, like a
+//    datagram, so every read() starts at a frame boundary.
 
 static ssize_t spi_read(struct file *file, char __user *buf, size_t len, loff_t *offset)
 {
-    if (len > 8)  // Limit the number of bytes to 8 for simplicity
-        len = 8;
+    struct spi_frame frame;
+    int ret;
 
-    // If data has been received (indicated by monitoring_flag)
-    if (monitoring_flag == 1) {
-        if (copy_to_user(buf, rx_buffer, len)) {
-            pr_err("Failed to send data to user\n");
-            return -EFAULT;  // Return error if data cannot be copied to user
-        }
-        monitoring_flag = 0;  // Reset monitoring flag after data transfer
-        return 0;  // Success
+    if (mutex_lock_interruptible(&spi_read_lock))
+        return -ERESTARTSYS;
+
+    while (!kfifo_get(&spi_frames, &frame)) {
+        mutex_unlock(&spi_read_lock);
+        if (file->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        ret = wait_event_interruptible(spi_wait, !kfifo_is_empty(&spi_frames));
+        if (ret)
+            return ret;
+        if (mutex_lock_interruptible(&spi_read_lock))
+            return -ERESTARTSYS;
+    }
+    mutex_unlock(&spi_read_lock);
+
+    len = min_t(size_t, len, frame.len);
+    if (copy_to_user(buf, frame.data, len)) {
+        pr_err("Failed to send data to user\n");
+        return -EFAULT;  // Return error if data cannot be copied to user
+    }
+    return len;  // One frame
+}
+
+// Readable while a frame is queued
+static __poll_t spi_poll(struct file *file, poll_table *wait)
+{
+    poll_wait(file, &spi_wait, wait);  // Woken when the capture queues a frame
+    return kfifo_is_empty(&spi_frames) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+// Pseudo Code for SPI write function:
+// 1. Copy the response from user space, zero-padded to the buffer size (longer data is cut).
+// 2. Replace the back buffer with it; a response staged earlier and not sent yet is dropped.
+// 3. The CS interrupt swaps it in at the start of the next frame; until then the current
+//    response keeps going out, and it is sent again for every frame without a new write().
+
+static ssize_t spi_write(struct file *file, const char __user *buf, size_t len, loff_t *offset)
+{
+    char data[sizeof(tx_bufs[0])] = { 0 };
+    unsigned long flags;
+
+    len = min(len, sizeof(data));
+    if (copy_from_user(data, buf, len)) {
+        pr_err("Failed to receive data from user\n");
+        return -EFAULT;
     }
 
-    return -EFAULT;  // Return error if no data available
+    spin_lock_irqsave(&spi_lock, flags);
+    memcpy(tx_back, data, sizeof(data));
+    tx_staged = true;
+    spin_unlock_irqrestore(&spi_lock, flags);
+
+    return len;
 }
 
 // Pseudo Code for file operations structure:
-// 1. Define the file operations: open, release, read.
+// 1. Define the file operations: open, release, read, write, poll.
 static struct file_operations spi_fops = {
     .owner = THIS_MODULE,  // Set owner to current module
     .open = spi_open,  // Define open function
     .release = spi_close,  // Define close function
     .read = spi_read,  // Define read function
+    .write = spi_write,  // Define write function
+    .poll = spi_poll,  // Define poll function
 };
 
+// Request the CS interrupt, and for the edge capture the SCLK one
+static int spi_request_irqs(void)
+{
+    int ret;
+
+    // Setup Chip Select IRQ (interrupt request)
+    cs_irq = gpio_to_irq(GPIO_CS);
+    if (cs_irq < 0) {
+        pr_err("Failed to get IRQ for CS\n");  // Log error if IRQ setup fails
+        return cs_irq;
+    }
+
+    // The thread only runs for capture=1; the hard handler decides
+    ret = request_threaded_irq(cs_irq, cs_irq_handler, cs_irq_thread,
+                               IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING, DRIVER_NAME, NULL);
+    if (ret) {
+        pr_err("Failed to request IRQ\n");  // Log error if IRQ request fails
+        return ret;
+    }
+
+    // Edge capture: an interrupt on every SCLK edge
+    if (capture == SPI_CAPTURE_EDGE) {
+        sclk_irq = gpio_to_irq(GPIO_SCLK);
+        ret = sclk_irq < 0 ? sclk_irq :
+              request_irq(sclk_irq, sclk_irq_handler, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                          DRIVER_NAME "_sclk", NULL);
+        if (ret) {
+            pr_err("Failed to request SCLK IRQ\n");
+            free_irq(cs_irq, NULL);  // Free IRQ if setup fails
+            return ret;
+        }
+    }
+    return 0;
+}
+
 // Pseudo Code for Module Initialization:
 // 1. Allocate a device number for the SPI slave device.
 // 2. Initialize the character device structure.
 // 3. Register the device with the system.
 // 4. Request GPIO pins for SPI signals (MOSI, MISO, SCLK, CS).
-// 5. Set up the IRQ for CS (Chip Select).
+// 5. Set up the IRQ for CS (Chip Select), or start the sampler thread or the logic analyzer.
 // 6. Log the success or failure of each initialization step.
 
 static int __init spi_slave_init(void)
 {
     int ret;
-    dev_t dev;
-    struct cdev spi_cdev;
 
     pr_info("Initializing SPI Slave Emulation\n");
 
+    // Check the frame format and pick the word loop for it
+    if (mode < 0 || mode > 3 || bits_per_word < 4 || bits_per_word > 32 ||
+        capture < SPI_CAPTURE_TASKLET || capture > SPI_CAPTURE_ANALYZER) {
+        pr_err("Unsupported SPI mode %d / %u bits per word / capture %d\n", mode, bits_per_word, capture);
+        return -EINVAL;
+    }
+    spi_xfer_word = spi_xfer_words[capture == SPI_CAPTURE_SAMPLER][lsb_first][mode];
+    poll_us = capture == SPI_CAPTURE_TASKLET;  // The tasklet keeps its udelay(1) polling
+    loaded_ns = ktime_get_ns();
+
     // Allocate a device number (major and minor numbers)
-    if ((alloc_chrdev_region(&dev, 0, 1, DRIVER_NAME)) < 0) {
+    if ((alloc_chrdev_region(&spi_dev, 0, 1, DRIVER_NAME)) < 0) {
         pr_err("Cannot allocate major number\n");  // Log error if allocation fails
         return -1;  // Return failure
     }
 
-    pr_info("Major = %d Minor = %d\n", MAJOR(dev), MINOR(dev));  // Log the allocated device number
+    pr_info("Major = %d Minor = %d\n", MAJOR(spi_dev), MINOR(spi_dev));  // Log the allocated device number
 
     // Initialize the character device structure with the file operations
     cdev_init(&spi_cdev, &spi_fops);
 
     // Add the character device to the system
-    if ((cdev_add(&spi_cdev, dev, 1)) < 0) {
+    if ((cdev_add(&spi_cdev, spi_dev, 1)) < 0) {
         pr_err("Cannot add the device to the system\n");  // Log error if adding fails
         goto r_cdev;  // Return failure
     }
@@ -204,7 +1131,7 @@ static int __init spi_slave_init(void)
         gpio_request(GPIO_SCLK, "SCLK") ||
         gpio_request(GPIO_CS, "CS")) {
         pr_err("Failed to request GPIOs\n");
-        goto r_cdev;
+        goto r_del;
     }
 
     gpio_direction_input(GPIO_MOSI);  // Set MOSI as input (receive data)
@@ -212,48 +1139,69 @@ static int __init spi_slave_init(void)
     gpio_direction_input(GPIO_SCLK);  // Set SCLK as input (clock signal)
     gpio_direction_input(GPIO_CS);  // Set CS as input (chip select)
 
-    // Setup Chip Select IRQ (interrupt request)
-    cs_irq = gpio_to_irq(GPIO_CS);
-    if (cs_irq < 0) {
-        pr_err("Failed to get IRQ for CS\n");  // Log error if IRQ setup fails
+    // The sampler polls CS itself, the analyzer has its own interrupts; every other capture
+    // starts from the CS interrupt
+    if (capture == SPI_CAPTURE_SAMPLER)
+        ret = spi_sampler_start();
+    else if (capture == SPI_CAPTURE_ANALYZER)
+        ret = spi_la_start();
+    else
+        ret = spi_request_irqs();
+    if (ret) {
+        pr_err("Failed to start the %s capture\n", capture_names[capture]);
         goto r_gpio;
     }
 
-    ret = request_irq(cs_irq, cs_irq_handler, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING, DRIVER_NAME, NULL);
-    if (ret) {
-        pr_err("Failed to request IRQ\n");  // Log error if IRQ request fails
-        goto r_irq;
+    // Best effort, the capture works without it
+    spi_debugfs = debugfs_create_dir(DRIVER_NAME, NULL);
+    debugfs_create_file("stats", 0444, spi_debugfs, NULL, &spi_stats_fops);
+    debugfs_create_file("expect", 0200, spi_debugfs, NULL, &spi_expect_fops);
+    if (capture == SPI_CAPTURE_ANALYZER) {
+        debugfs_create_file("capture", 0400, spi_debugfs, NULL, &spi_la_capture_fops);
+        debugfs_create_file("decode", 0400, spi_debugfs, NULL, &spi_la_decode_fops);
     }
 
-    pr_info("SPI Slave Emulation Initialized\n");
+    pr_info("SPI Slave Emulation Initialized (%s capture)\n", capture_names[capture]);
     return 0;  // Success
 
-r_irq:
-    free_irq(cs_irq, NULL);  // Free IRQ if setup fails
-
 r_gpio:
     gpio_free(GPIO_MOSI);  // Free GPIO resources
     gpio_free(GPIO_MISO);
     gpio_free(GPIO_SCLK);
     gpio_free(GPIO_CS);
 
+r_del:
+    cdev_del(&spi_cdev);
+
 r_cdev:
-    unregister_chrdev_region(dev, 1);  // Free the allocated device number
+    unregister_chrdev_region(spi_dev, 1);  // Free the allocated device number
     return -EFAULT;  // Return error
 }
 
 // Pseudo Code for Module Cleanup:
-// 1. Free the IRQ and GPIO resources.
-// 2. Unregister the device.
+// 1. Stop the sampler thread or free the IRQs (and the analyzer ring), then free the GPIO resources.
+// 2. Remove the character device and unregister the device number.
 // 3. Log the cleanup process.
 
 static void __exit spi_slave_exit(void)
 {
-    free_irq(cs_irq, NULL);  // Free IRQ resources
+    debugfs_remove_recursive(spi_debugfs);
+    if (capture == SPI_CAPTURE_SAMPLER) {
+        kthread_stop(sampler_task);
+    } else if (capture == SPI_CAPTURE_ANALYZER) {
+        spi_la_stop();
+    } else {
+        if (capture == SPI_CAPTURE_EDGE)
+            free_irq(sclk_irq, NULL);
+        free_irq(cs_irq, NULL);  // Free IRQ resources
+    }
+    tasklet_kill(&spi_tasklet);  // A frame may still be running
     gpio_free(GPIO_MOSI);  // Free GPIO resources
     gpio_free(GPIO_MISO);
     gpio_free(GPIO_SCLK);
     gpio_free(GPIO_CS);
+    cdev_del(&spi_cdev);  // Remove the character device
+    unregister_chrdev_region(spi_dev, 1);  // Free the device number
 
     pr_info("SPI Slave Emulation Exited\n");  // Log exit message
 }
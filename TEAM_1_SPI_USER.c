@@ -15,15 +15,12 @@ void main(int argc,char **argv)
 
         write(fd2,argv[1],strlen(argv[1])+1);
 
-        while(1)
+        ret=read(fd1,buffer,sizeof(buffer)-1);   // blocks until the slave has received one frame
+        if(ret<0)
         {
-                ret=read(fd1,buffer,sizeof(buffer));
-                if(ret==0)
-                {
-                        break;
-                }
-
-
+                perror("read");
+                return;
         }
+        buffer[ret]='\0';
         printf("data received : %s\n",buffer);
 }
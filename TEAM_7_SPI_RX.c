@@ -4,12 +4,18 @@
  * 1. Initialize GPIO pins for SPI communication (MOSI, MISO, SCLK, CS, LED).
  * 2. Set up a character device for user space communication.
  * 3. Configure the interrupt for Chip Select (CS) pin to trigger an interrupt on rising and falling edges.
- * 4. Emulate SPI data transfer in response to the CS interrupt:
- *    a. Wait for clock pulses (SCLK) and read the MOSI pin.
- *    b. Write to the MISO pin based on the emulated response data.
+ * 4. Emulate SPI data transfer (mode 0, MSB first) in response to the CS interrupt, with the
+ *    capture picked by the module parameter capture:
+ *    0: a tasklet polls SCLK for the whole frame in softirq context (the original method)
+ *    1: the threaded CS interrupt polls SCLK, outside softirq context
+ *    2: an interrupt on every SCLK edge moves one bit
+ *    a. On the rising edge of SCLK, read the MOSI pin.
+ *    b. After the falling edge, write the next bit of the emulated response data to MISO.
  * 5. Handle the received data, and if it’s 0 or 1, toggle the LED accordingly.
  * 6. Provide feedback to user-space through the character device (success/failure).
  * 7. Clean up GPIOs and IRQ on module unload.
+ * 8. Report the capture statistics in debugfs spi_slave_emulation/stats: the fastest master
+ *    clock received without errors and the time the capture kept softirqs or hard IRQs waiting.
  */
 
 #include <linux/init.h>             // For module initialization and cleanup
@@ -21,6 +27,11 @@
 #include <linux/fs.h>               // For file operations
 #include <linux/uaccess.h>          // For copy_to_user and copy_from_user
 #include <linux/cdev.h>             // For character device registration
+#include <linux/spinlock.h>         // For the edge capture state and the statistics
+#include <linux/ktime.h>            // For timing frames and handlers
+#include <linux/math64.h>           // For the clock rate division
+#include <linux/debugfs.h>          // For publishing the capture statistics
+#include <linux/seq_file.h>         // For formatting the statistics file
 
 #define DRIVER_NAME "spi_slave_emulation"  // Name of the driver
 #define GPIO_MOSI 535                    // GPIO Pin for MOSI (Master Out Slave In)
@@ -29,13 +40,49 @@
 #define GPIO_CS   520                    // GPIO Pin for CS (Chip Select)
 #define GPIO_LED  529                    // GPIO Pin for LED (to show success/failure)
 
+// How the bits are captured
+enum { SPI_CAPTURE_TASKLET, SPI_CAPTURE_THREAD, SPI_CAPTURE_EDGE };
+static const char * const capture_names[] = { "tasklet", "thread", "edge" };
+static int capture = SPI_CAPTURE_THREAD;
+module_param(capture, int, 0444);
+MODULE_PARM_DESC(capture, "Bit capture: 0 = tasklet polling SCLK (softirq), 1 = threaded CS IRQ polling SCLK, 2 = SCLK edge interrupts");
+
 static void spi_emulate_transfer(struct tasklet_struct *spi);
 
 // Variables
 static int cs_irq;                          // Interrupt number for CS pin
+static int sclk_irq = -1;                   // Interrupt number for SCLK pin (edge capture)
 static volatile bool spi_active = false;    // Flag to indicate if SPI is active
+static unsigned int poll_us = 1;            // SCLK poll interval, 0 = spin (threaded capture)
 int monitoring_flag = 0;                    // Flag for monitoring the communication
 
+// Capture statistics, for comparing the capture methods (spi_lock)
+struct spi_slave_stats {
+    u64 frames;          // CS assertions handled
+    u64 bytes;           // Complete bytes received
+    u64 cut_bytes;       // Bytes cut short by CS: clock edges were missed (or extra)
+    u64 edges;           // SCLK interrupts taken (edge capture)
+    u32 last_hz;         // SCLK rate of the last frame, from its first to its last sample
+    u32 max_clean_hz;    // Fastest frame without cut bytes: the fastest reliable master clock
+    u64 softirq_max_ns;  // Longest capture run in softirq context (tasklet capture)
+    u64 hardirq_max_ns;  // Longest SCLK interrupt (edge capture)
+    u64 busy_ns;         // CPU time spent capturing
+};
+
+// Frame in progress for the edge capture (spi_lock)
+struct spi_edge_frame {
+    int byte_idx;            // Byte index for receiving data
+    int bit_idx;             // Bit index for the current byte
+    char received_byte;      // Byte being received
+    unsigned int samples;    // Rising edges in the frame
+    u64 first_ns, last_ns;   // First and last rising edge
+};
+
+static DEFINE_SPINLOCK(spi_lock);           // Protects stats and edge_frame
+static struct spi_slave_stats stats;
+static struct spi_edge_frame edge_frame;
+static struct dentry *spi_debugfs;          // debugfs spi_slave_emulation directory
+
 DECLARE_TASKLET(spi_tasklet, spi_emulate_transfer);  // Declaring a tasklet for SPI emulation
 
 // SPI buffer for communication (rx and tx buffers)
@@ -54,48 +101,106 @@ static int spi_close(struct inode *inode, struct file *file) {
     return 0;
 }
 
-// Interrupt Handler for Chip Select (CS) pin
+static void spi_edge_start(void);
+static void spi_edge_end(void);
+
+// Interrupt Handler for Chip Select (CS) pin: start the capture picked by the capture parameter
 static irqreturn_t cs_irq_handler(int irq, void *dev_id) {
     spi_active = !gpio_get_value(GPIO_CS);  // Toggle the SPI active status based on CS pin value
-    if (spi_active) {
-        tasklet_schedule(&spi_tasklet);  // Schedule the tasklet to handle SPI communication
-        pr_info("SPI communication started\n");
-    } else {
-        pr_info("SPI communication ended\n");
+
+    if (capture == SPI_CAPTURE_EDGE) {
+        if (spi_active)
+            spi_edge_start();
+        else
+            spi_edge_end();
+        return IRQ_HANDLED;
     }
+
+    if (!spi_active)
+        return IRQ_HANDLED;  // The polling loop notices and stops
+    if (capture == SPI_CAPTURE_THREAD)
+        return IRQ_WAKE_THREAD;  // Poll in cs_irq_thread, outside softirq context
+    tasklet_schedule(&spi_tasklet);  // Schedule the tasklet to handle SPI communication
     return IRQ_HANDLED;  // Acknowledge the interrupt
 }
 
-// Function to emulate the SPI transfer
-static void spi_emulate_transfer(struct tasklet_struct *spi) {
+// After communication ends, interpret the received data
+static void spi_frame_done(const char *data) {
+    int value = simple_strtol(data, NULL, 10);  // Convert received data to an integer
+
+    if (value == 0 || value == 1) {
+        monitoring_flag = 1;
+        gpio_set_value(GPIO_LED, value);  // Set LED based on received value
+        pr_info("GPIO Device write: %d\n", value);  // Log the operation
+    } else {
+        monitoring_flag = -1;
+        pr_err("Invalid value: GPIO accepts 0 or 1\n");  // Log error if invalid data received
+    }
+}
+
+// Count a finished frame; span_bits bits were sampled in span_ns
+static void spi_account_frame(unsigned int bytes, bool cut, u64 span_bits, u64 span_ns, u64 busy_ns) {
+    unsigned long flags;
+    u32 hz = 0;
+
+    if (span_bits && span_ns)
+        hz = div64_u64(span_bits * NSEC_PER_SEC, span_ns);
+
+    spin_lock_irqsave(&spi_lock, flags);
+    stats.frames++;
+    stats.bytes += bytes;
+    stats.cut_bytes += cut;
+    stats.busy_ns += busy_ns;
+    if (hz) {
+        stats.last_hz = hz;
+        if (!cut && hz > stats.max_clean_hz)
+            stats.max_clean_hz = hz;
+    }
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
+
+// Poll SCLK until it reaches the given level; false if the master released CS first
+static bool spi_wait_sclk(int level) {
+    while (gpio_get_value(GPIO_SCLK) != level) {
+        if (!spi_active)
+            return false;
+        if (poll_us)
+            udelay(poll_us);  // Busy wait (to avoid high CPU usage)
+        else
+            cpu_relax();      // Own thread: spin for the shortest reaction time
+    }
+    return true;
+}
+
+// Emulate the SPI transfer by polling SCLK (tasklet and threaded capture)
+static void spi_poll_frame(void) {
     int byte_idx = 0;            // Byte index for receiving data
     int bit_idx = 0;             // Bit index for the current byte
     char received_byte = 0;      // Variable to store the received byte
+    unsigned int samples = 0;    // Rising edges seen
+    u64 start = ktime_get_ns(), first = 0, last = 0;
+
+    // The first bit goes out before the first rising edge
+    gpio_set_value(GPIO_MISO, (tx_buffer[0] >> 7) & 0x01);
 
     // Emulate SPI data transfer while SPI is active
     while (spi_active) {
-        // Wait for the clock falling edge (polling SCLK)
-        while (gpio_get_value(GPIO_SCLK) && spi_active) {
-            udelay(1);  // Busy wait (to avoid high CPU usage)
-        }
-
-        if (!spi_active)  // Check if SPI communication has ended
+        // Wait for the clock rising edge, on which the master samples MISO and we sample MOSI
+        if (!spi_wait_sclk(1))
             break;
 
         // Read the MOSI (Master Out Slave In) bit
-        int mosi_bit = gpio_get_value(GPIO_MOSI);
-        received_byte = (received_byte << 1) | mosi_bit;  // Shift and store the bit
-
-        // Write the MISO (Master In Slave Out) bit from the tx_buffer
-        int miso_bit = (tx_buffer[byte_idx] >> (7 - bit_idx)) & 0x01;
-        gpio_set_value(GPIO_MISO, miso_bit);
+        received_byte = (received_byte << 1) | !!gpio_get_value(GPIO_MOSI);  // Shift and store the bit
+        last = ktime_get_ns();
+        if (!samples++)
+            first = last;
 
         bit_idx++;  // Move to the next bit
 
         // If all 8 bits of a byte are received, store the byte and prepare for the next byte
         if (bit_idx == 8) {
             rx_buffer[byte_idx] = received_byte;
-            pr_info("Received Byte: 0x%02x\n", received_byte);  // Log received byte
+            pr_debug("Received Byte: 0x%02x\n", received_byte);  // Log received byte
             received_byte = 0;  // Reset for next byte
             bit_idx = 0;        // Reset bit index
             byte_idx++;         // Move to next byte in the buffer
@@ -104,25 +209,117 @@ static void spi_emulate_transfer(struct tasklet_struct *spi) {
                 break;
         }
 
-        // Wait for clock rising edge (polling SCLK)
-        while (!gpio_get_value(GPIO_SCLK) && spi_active) {
-            udelay(1);  // Busy wait
-        }
+        // Wait for the clock falling edge, then write the next MISO bit from the tx_buffer
+        if (!spi_wait_sclk(0))
+            break;
+        gpio_set_value(GPIO_MISO, (tx_buffer[byte_idx] >> (7 - bit_idx)) & 0x01);
     }
 
-    // After communication ends, interpret the received data
-    int value = simple_strtol(rx_buffer, NULL, 10);  // Convert received data to an integer
+    spi_account_frame(byte_idx, bit_idx != 0, samples ? samples - 1 : 0, last - first,
+                      ktime_get_ns() - start);
+    spi_frame_done(rx_buffer);
+}
+
+// Original capture: poll the whole frame from the tasklet, with softirqs held off meanwhile
+static void spi_emulate_transfer(struct tasklet_struct *spi) {
+    u64 start = ktime_get_ns(), ns;
+    unsigned long flags;
 
-    if (value == 0 || value == 1) {
-        monitoring_flag = 1;
-        gpio_set_value(GPIO_LED, value);  // Set LED based on received value
-        pr_info("GPIO Device write: %d\n", value);  // Log the operation
-    } else {
-        monitoring_flag = -1;
-        pr_err("Invalid value: GPIO accepts 0 or 1\n");  // Log error if invalid data received
+    spi_poll_frame();
+
+    ns = ktime_get_ns() - start;
+    spin_lock_irqsave(&spi_lock, flags);
+    stats.softirq_max_ns = max(stats.softirq_max_ns, ns);
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
+
+// Threaded capture: poll the frame in the CS interrupt's thread, a SCHED_FIFO task that
+// softirqs and other interrupts can preempt
+static irqreturn_t cs_irq_thread(int irq, void *dev_id) {
+    if (spi_active)
+        spi_poll_frame();
+    return IRQ_HANDLED;
+}
+
+// Edge capture: CS asserted, put the first bit on MISO before the first rising edge
+static void spi_edge_start(void) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    memset(&edge_frame, 0, sizeof(edge_frame));
+    gpio_set_value(GPIO_MISO, (tx_buffer[0] >> 7) & 0x01);
+    spin_unlock_irqrestore(&spi_lock, flags);
+}
+
+// Edge capture: CS released, account and interpret the frame. The SCLK handler writes rx_buffer
+// under spi_lock, and a late edge may still come in, so the frame is copied out under it too.
+static void spi_edge_end(void) {
+    struct spi_edge_frame fr;
+    char data[sizeof(rx_buffer) + 1];
+    unsigned long flags;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    fr = edge_frame;
+    memcpy(data, rx_buffer, fr.byte_idx);
+    spin_unlock_irqrestore(&spi_lock, flags);
+    data[fr.byte_idx] = '\0';
+
+    spi_account_frame(fr.byte_idx, fr.bit_idx != 0, fr.samples ? fr.samples - 1 : 0,
+                      fr.last_ns - fr.first_ns, 0);
+    spi_frame_done(data);
+}
+
+// Edge capture: sample MOSI on a rising edge, put the next MISO bit out on a falling one. The
+// level read here tells which edge it was, so a missed edge costs one byte, not the frame.
+static irqreturn_t sclk_irq_handler(int irq, void *dev_id) {
+    u64 start = ktime_get_ns(), ns;
+
+    spin_lock(&spi_lock);
+    stats.edges++;
+    if (!spi_active || edge_frame.byte_idx >= sizeof(rx_buffer))
+        goto out;  // Not selected, or the buffer is full
+
+    if (!gpio_get_value(GPIO_SCLK)) {
+        gpio_set_value(GPIO_MISO, (tx_buffer[edge_frame.byte_idx] >> (7 - edge_frame.bit_idx)) & 0x01);
+        goto out;
+    }
+
+    edge_frame.received_byte = (edge_frame.received_byte << 1) | !!gpio_get_value(GPIO_MOSI);
+    edge_frame.last_ns = start;
+    if (!edge_frame.samples++)
+        edge_frame.first_ns = start;
+    if (++edge_frame.bit_idx == 8) {
+        rx_buffer[edge_frame.byte_idx++] = edge_frame.received_byte;
+        edge_frame.received_byte = 0;
+        edge_frame.bit_idx = 0;
     }
+
+out:
+    ns = ktime_get_ns() - start;
+    stats.hardirq_max_ns = max(stats.hardirq_max_ns, ns);
+    stats.busy_ns += ns;
+    spin_unlock(&spi_lock);
+    return IRQ_HANDLED;
 }
 
+// debugfs spi_slave_emulation/stats: compare capture=0 (before) with capture=1 or 2 (after)
+static int spi_stats_show(struct seq_file *m, void *v) {
+    struct spi_slave_stats s;
+    unsigned long flags;
+
+    spin_lock_irqsave(&spi_lock, flags);
+    s = stats;
+    spin_unlock_irqrestore(&spi_lock, flags);
+
+    seq_printf(m, "capture: %s\nframes: %llu\nbytes: %llu\ncut_bytes: %llu\nedges: %llu\n",
+               capture_names[capture], s.frames, s.bytes, s.cut_bytes, s.edges);
+    seq_printf(m, "last_hz: %u\nmax_clean_hz: %u\n", s.last_hz, s.max_clean_hz);
+    seq_printf(m, "softirq_max_ns: %llu\nhardirq_max_ns: %llu\nbusy_ns: %llu\n",
+               s.softirq_max_ns, s.hardirq_max_ns, s.busy_ns);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(spi_stats);
+
 // Read function to return result to user-space
 static ssize_t spi_read(struct file *file, char __user *buf, size_t len, loff_t *offset) {
     // Handle success or failure based on monitoring_flag
@@ -161,6 +358,10 @@ static int __init spi_slave_init(void) {
 
     pr_info("Initializing SPI Slave Emulation\n");
 
+    if (capture < SPI_CAPTURE_TASKLET || capture > SPI_CAPTURE_EDGE)
+        return -EINVAL;
+    poll_us = capture == SPI_CAPTURE_TASKLET;  // The tasklet keeps its udelay(1) polling
+
     // Allocate device number for the character device
     if ((alloc_chrdev_region(&dev, 0, 1, DRIVER_NAME)) < 0) {
         pr_err("Cannot allocate major number\n");
@@ -173,7 +374,8 @@ static int __init spi_slave_init(void) {
     cdev_init(&spi_cdev, &spi_fops);
 
     // Add the character device to the system
-    if ((cdev_add(&spi_cdev, dev, 1)) < 0) {
+    ret = cdev_add(&spi_cdev, dev, 1);
+    if (ret < 0) {
         pr_err("Cannot add the device to the system\n");
         goto r_cdev;
     }
@@ -184,6 +386,7 @@ static int __init spi_slave_init(void) {
         gpio_request(GPIO_SCLK, "SCLK") ||
         gpio_request(GPIO_CS, "CS")) {
         pr_err("Failed to request GPIOs\n");
+        ret = -EBUSY;
         goto r_cdev;
     }
 
@@ -196,17 +399,36 @@ static int __init spi_slave_init(void) {
     cs_irq = gpio_to_irq(GPIO_CS);
     if (cs_irq < 0) {
         pr_err("Failed to get IRQ for CS\n");
+        ret = cs_irq;
         goto r_gpio;
     }
 
-    // Request IRQ for CS pin
-    ret = request_irq(cs_irq, cs_irq_handler, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING, DRIVER_NAME, NULL);
+    // Request IRQ for CS pin; the thread only runs for capture=1, the hard handler decides
+    ret = request_threaded_irq(cs_irq, cs_irq_handler, cs_irq_thread,
+                               IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING, DRIVER_NAME, NULL);
     if (ret) {
         pr_err("Failed to request IRQ\n");
-        goto r_irq;
+        goto r_gpio;
     }
 
-    pr_info("SPI Slave Emulation Initialized\n");
+    // Edge capture: an interrupt on every SCLK edge
+    if (capture == SPI_CAPTURE_EDGE) {
+        sclk_irq = gpio_to_irq(GPIO_SCLK);
+        ret = sclk_irq < 0 ? sclk_irq :
+              request_irq(sclk_irq, sclk_irq_handler, IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING,
+                          DRIVER_NAME "_sclk", NULL);
+        if (ret) {
+            pr_err("Failed to request SCLK IRQ\n");
+            sclk_irq = -1;
+            goto r_irq;  // Only the CS IRQ was requested
+        }
+    }
+
+    // Best effort, the capture works without it
+    spi_debugfs = debugfs_create_dir(DRIVER_NAME, NULL);
+    debugfs_create_file("stats", 0444, spi_debugfs, NULL, &spi_stats_fops);
+
+    pr_info("SPI Slave Emulation Initialized (%s capture)\n", capture_names[capture]);
     return 0;
 
 r_irq:
@@ -220,12 +442,16 @@ r_gpio:
 
 r_cdev:
     unregister_chrdev_region(dev, 1);  // Free the allocated device number
-    return -EFAULT;
+    return ret;
 }
 
 // Module Cleanup function
 static void __exit spi_slave_exit(void) {
+    debugfs_remove_recursive(spi_debugfs);
+    if (capture == SPI_CAPTURE_EDGE)
+        free_irq(sclk_irq, NULL);
     free_irq(cs_irq, NULL);  // Free IRQ
+    tasklet_kill(&spi_tasklet);  // A frame may still be running
     gpio_free(GPIO_MOSI);    // Free GPIO pins
     gpio_free(GPIO_MISO);
     gpio_free(GPIO_SCLK);
@@ -0,0 +1,29 @@
+/*
+ * Logic-analyzer records of the SPI slave emulation (TEAM_1_SPI_RX.c, capture=4).
+ * Shared between the kernel module and offline decoders.
+ *
+ * debugfs spi_slave_emulation/capture returns the retained records, oldest first, as an array
+ * of struct spi_la_record. Recording pauses while the file is open, so one read-out is
+ * consistent; transitions during the pause are lost (counted as la_dropped in the stats).
+ * debugfs spi_slave_emulation/decode replays the same records through the driver's decoder.
+ */
+
+#ifndef SPI_SLAVE_CAPTURE_H
+#define SPI_SLAVE_CAPTURE_H
+
+#include <linux/types.h>
+
+// Bits of spi_la_record.levels and values of spi_la_record.pin
+#define SPI_LA_CS   (1 << 0)
+#define SPI_LA_SCLK (1 << 1)
+#define SPI_LA_MOSI (1 << 2)
+
+// One transition: an interrupt on an edge of one of the pins
+struct spi_la_record {
+    __u64 timestamp_ns; // ktime_get() on entry to the interrupt handler
+    __u8  levels;       // SPI_LA_* bits of the pins at high level, read in the handler
+    __u8  pin;          // SPI_LA_* of the pin whose edge raised the interrupt
+    __u8  reserved[6];
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * UART throughput benchmark
+ *
+ * Reads from the UART driver for a fixed time and reports the received bytes/s,
+ * the CPU time of this process, the system-wide CPU usage (which includes the
+ * time spent in the driver's interrupt handler) and the interrupt rate of every
+ * /proc/interrupts line matching one of the -i names.
+ *
+ * Compare the driver modes by loading it with polling=1 (PIO), with the PL011 IRQ
+ * (IRQ) and with the IRQ plus dma=1 (DMA), at each baud rate, while the peer
+ * streams data continuously. The driver names each port's IRQ after the device:
+ *   ./uart_bench -d /dev/uart0 -t 10 -b 4096 -i 3f201000.serial,dma -m irq -s 921600
+ * Run one instance per /dev/uartN to load several ports at the same time.
+ * -s reprograms the driver's line rate (8N1) through UART_IOC_SET_LINE first.
+ * -M consumes the driver's mmap RX ring instead of calling read(); the syscall
+ * count then only covers the poll() wakeups.
+ * The peer side can be generated with the same tool:
+ *   ./uart_bench -d /dev/ttyUSB0 -t 10 -w
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+
+#include "uart_ioctl.h"
+
+#define DEFAULT_DEVICE "/dev/uart0"
+
+// Read the busy and total jiffies of all CPUs from /proc/stat
+static void read_cpu_stat(unsigned long long *busy, unsigned long long *total)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq;
+	FILE *fp = fopen("/proc/stat", "r");
+
+	*busy = *total = 0;
+	if (!fp)
+		return;
+	if (fscanf(fp, "cpu %llu %llu %llu %llu %llu %llu %llu",
+		   &user, &nice, &sys, &idle, &iowait, &irq, &softirq) == 7) {
+		*busy = user + nice + sys + irq + softirq;
+		*total = *busy + idle + iowait;
+	}
+	fclose(fp);
+}
+
+// Sum the interrupt counts of every /proc/interrupts line that mentions one of the names
+static unsigned long long read_irq_count(const char *names)
+{
+	unsigned long long sum = 0;
+	char line[1024], list[256], *name, *p, *end;
+	FILE *fp;
+
+	if (!names)
+		return 0;
+	fp = fopen("/proc/interrupts", "r");
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		int match = 0;
+
+		snprintf(list, sizeof(list), "%s", names);
+		for (name = strtok(list, ","); name; name = strtok(NULL, ","))
+			if (strstr(line, name))
+				match = 1;
+		if (!match || !(p = strchr(line, ':')))
+			continue;
+
+		// Per-CPU counts follow the "NN:" label
+		for (p++;; p = end) {
+			unsigned long long v = strtoull(p, &end, 10);
+
+			if (end == p)
+				break;
+			sum += v;
+		}
+	}
+	fclose(fp);
+	return sum;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_seconds(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+// Consume the mmap RX ring: poll() only when it is empty, never copy through the kernel
+static void mmap_loop(int fd, int seconds, double t0, unsigned long long *bytes,
+		      unsigned long long *calls)
+{
+	size_t len = getpagesize() + UART_MMAP_DATA_SIZE;
+	struct uart_mmap_ring *ring = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	volatile unsigned char sink = 0;
+	const unsigned char *data;
+
+	if (ring == MAP_FAILED) {
+		perror("mmap");
+		return;
+	}
+	data = (const unsigned char *)ring + ring->data_offset;
+
+	while (now() - t0 < seconds) {
+		unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		unsigned int tail = ring->tail;
+
+		if (head == tail) {
+			poll(&pfd, 1, 100); // Sleep until the interrupt handler publishes more data
+			(*calls)++;
+			continue;
+		}
+		for (; tail != head; tail++)
+			sink ^= data[tail & (ring->size - 1)]; // Touch every byte like a real consumer
+		*bytes += head - ring->tail;
+		__atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+	}
+	(void)sink;
+	munmap(ring, len);
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = DEFAULT_DEVICE, *irq_names = NULL, *mode = "";
+	int seconds = 10, bufsize = 4096, writer = 0, use_mmap = 0, opt, fd;
+	unsigned int baud = 0;
+	unsigned long long busy0, total0, busy1, total1, irq0, irq1, bytes = 0, calls = 0;
+	double t0, c0, elapsed;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "d:t:b:wi:m:s:M")) != -1) {
+		switch (opt) {
+		case 'd': path = optarg; break;
+		case 't': seconds = atoi(optarg); break;
+		case 'b': bufsize = atoi(optarg); break;
+		case 'w': writer = 1; break;
+		case 'i': irq_names = optarg; break;
+		case 'm': mode = optarg; break;
+		case 's': baud = strtoul(optarg, NULL, 0); break;
+		case 'M': use_mmap = 1; break;
+		default:
+			fprintf(stderr, "usage: %s [-d dev] [-t seconds] [-b bufsize] [-w] [-i irq,names] [-m label] [-s baud] [-M]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	buf = malloc(bufsize);
+	fd = open(path, writer ? O_WRONLY : O_RDWR);
+	if (!buf || fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if (baud) {
+		struct uart_line_config cfg = { .baud = baud, .data_bits = 8, .stop_bits = 1 };
+
+		if (ioctl(fd, UART_IOC_SET_LINE, &cfg) < 0) {
+			perror("UART_IOC_SET_LINE");
+			return 1;
+		}
+		printf("line rate %u baud (requested %u, error %d ppm, UARTCLK %u Hz)\n",
+		       cfg.actual_baud, baud, cfg.error_ppm, cfg.uartclk);
+	}
+	for (int i = 0; i < bufsize; i++)
+		buf[i] = 'A' + i % 26;
+
+	read_cpu_stat(&busy0, &total0);
+	irq0 = read_irq_count(irq_names);
+	t0 = now();
+	c0 = cpu_seconds();
+
+	if (use_mmap && !writer)
+		mmap_loop(fd, seconds, t0, &bytes, &calls);
+
+	while (!use_mmap && now() - t0 < seconds) {
+		ssize_t n = writer ? write(fd, buf, bufsize) : read(fd, buf, bufsize);
+
+		if (n < 0) {
+			perror(writer ? "write" : "read");
+			break;
+		}
+		bytes += n;
+		calls++;
+	}
+
+	elapsed = now() - t0;
+	read_cpu_stat(&busy1, &total1);
+	irq1 = read_irq_count(irq_names);
+
+	printf("%s%s%s: %llu bytes in %.2f s = %.0f bytes/s (%llu syscalls, %.1f bytes/call)\n",
+	       mode, *mode ? " " : "", writer ? "tx" : "rx", bytes, elapsed, bytes / elapsed, calls,
+	       calls ? (double)bytes / calls : 0.0);
+	printf("process CPU: %.1f%%  system CPU: %.1f%%\n",
+	       100.0 * (cpu_seconds() - c0) / elapsed,
+	       total1 > total0 ? 100.0 * (busy1 - busy0) / (total1 - total0) : 0.0);
+	if (irq_names)
+		printf("interrupts (%s): %.0f/s\n", irq_names, (irq1 - irq0) / elapsed);
+
+	if (!writer) {
+		struct uart_rx_errors err;
+
+		// Tell driver-side losses (ring full) apart from line-side ones (overrun, framing)
+		if (ioctl(fd, UART_IOC_GET_ERRORS, &err) == 0)
+			printf("rx errors: %llu overrun, %llu framing, %llu parity, %llu break, %llu dropped, %llu throttled\n",
+			       (unsigned long long)err.overrun, (unsigned long long)err.framing,
+			       (unsigned long long)err.parity, (unsigned long long)err.brk,
+			       (unsigned long long)err.dropped, (unsigned long long)err.throttled);
+	}
+
+	close(fd);
+	free(buf);
+	return 0;
+}
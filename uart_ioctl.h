@@ -0,0 +1,119 @@
+/*
+ * ioctl interface of the PL011 UART driver (uart_rx_data.c).
+ * Shared between the kernel module and the user-space programs.
+ */
+
+#ifndef UART_IOCTL_H
+#define UART_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define UART_IOC_MAGIC 'U'
+
+// Parity settings for uart_line_config.parity
+#define UART_PARITY_NONE 0
+#define UART_PARITY_ODD  1
+#define UART_PARITY_EVEN 2
+
+// Flow control settings for uart_line_config.flow
+#define UART_FLOW_NONE   0
+#define UART_FLOW_RTSCTS 1 // RTS follows the driver's RX ring watermarks, CTS gates TX
+
+// Line settings; the divisors are derived from the UART reference clock (UARTCLK)
+struct uart_line_config {
+    __u32 baud;        // Requested baud rate
+    __u8  data_bits;   // 5 to 8 data bits
+    __u8  parity;      // UART_PARITY_NONE / UART_PARITY_ODD / UART_PARITY_EVEN
+    __u8  stop_bits;   // 1 or 2 stop bits
+    __u8  flow;        // UART_FLOW_NONE / UART_FLOW_RTSCTS
+    __u32 actual_baud; // Out: rate the programmed divisors really produce
+    __s32 error_ppm;   // Out: (actual - requested) / requested, in parts per million
+    __u32 uartclk;     // Out: reference clock the divisors were computed from
+};
+
+#define UART_IOC_SET_LINE _IOWR(UART_IOC_MAGIC, 1, struct uart_line_config) // Drain TX, then reprogram
+#define UART_IOC_GET_LINE _IOR(UART_IOC_MAGIC, 2, struct uart_line_config)  // Read the current settings
+
+// Receive error counters since the module was loaded
+struct uart_rx_errors {
+    __u64 overrun;     // Characters lost because the hardware RX FIFO was full
+    __u64 framing;     // Characters received without a valid stop bit
+    __u64 parity;      // Characters received with a parity mismatch
+    __u64 brk;         // Break conditions detected on the line
+    __u64 dropped;     // Characters lost because the driver's RX ring buffer was full
+    __u64 throttled;   // Times RTS was deasserted at the RX ring high watermark
+};
+
+#define UART_IOC_GET_ERRORS _IOR(UART_IOC_MAGIC, 3, struct uart_rx_errors)
+
+/*
+ * In-kernel LED commands (uart_rx_data.c only): newline-terminated "ON", "OFF", "TOGGLE" and
+ * "PULSE [ms]" are executed by the receive path and acknowledged with "1\n" / "0\n" (LED state
+ * afterwards) or "E\n". latency_hist[i] counts commands whose interrupt-to-GPIO latency was in
+ * [2^i, 2^(i+1)) ns; the last bucket also takes everything slower.
+ */
+#define UART_CMD_HIST_BUCKETS 32
+
+struct uart_cmd_stats {
+    __u64 commands;       // Commands executed
+    __u64 invalid;        // Lines that were not a known command
+    __u64 max_latency_ns; // Slowest actuation seen
+    __u64 latency_hist[UART_CMD_HIST_BUCKETS];
+};
+
+#define UART_IOC_GET_CMD_STATS _IOR(UART_IOC_MAGIC, 4, struct uart_cmd_stats)
+
+/*
+ * Timestamped receive (uart_rx_data.c only): with a mode other than UART_RX_TSTAMP_OFF, read()
+ * returns packed records, each a struct uart_rx_record followed by len data bytes with no padding.
+ * UART_RX_TSTAMP_CHUNK closes a record after every pickup of the receive path (RX interrupt, DMA
+ * buffer or polling pass); UART_RX_TSTAMP_DELIM closes it after each delim byte, or once it holds
+ * UART_RX_RECORD_MAX bytes. timestamp_ns is CLOCK_MONOTONIC when the driver picked up the first
+ * byte of the record, which trails the stop bit by up to one FIFO trigger level (or the RX
+ * timeout of 32 bit periods). A read() buffer must have room for a header and at least one byte;
+ * records that do not fit are split. Switching the mode discards any buffered input.
+ */
+#define UART_RX_TSTAMP_OFF   0
+#define UART_RX_TSTAMP_CHUNK 1
+#define UART_RX_TSTAMP_DELIM 2
+
+#define UART_RX_RECORD_MAX 1024
+
+struct uart_rx_tstamp_config {
+    __u8 mode;         // UART_RX_TSTAMP_OFF / UART_RX_TSTAMP_CHUNK / UART_RX_TSTAMP_DELIM
+    __u8 delim;        // Record terminator for UART_RX_TSTAMP_DELIM, e.g. '\n'
+    __u8 reserved[2];
+};
+
+#define UART_RX_REC_SPLIT   (1 << 0) // More bytes of this record follow in the next one
+#define UART_RX_REC_DROPPED (1 << 1) // Bytes were lost (RX ring full) just before or inside this record
+
+struct uart_rx_record {
+    __u64 timestamp_ns; // ktime_get() at the pickup of the first byte
+    __u32 len;          // Data bytes following this header
+    __u32 flags;        // UART_RX_REC_*
+};
+
+#define UART_IOC_SET_RX_TSTAMP _IOW(UART_IOC_MAGIC, 5, struct uart_rx_tstamp_config)
+#define UART_IOC_GET_RX_TSTAMP _IOR(UART_IOC_MAGIC, 6, struct uart_rx_tstamp_config)
+
+/*
+ * Zero-copy receive: mmap() getpagesize() + UART_MMAP_DATA_SIZE bytes at offset 0. The first
+ * page holds struct uart_mmap_ring, the data area follows at data_offset. While the ring is
+ * mapped the driver stores received bytes there instead of handing them to read().
+ * head and tail are free-running byte counters; index the data area with (counter & (size - 1)).
+ * The driver publishes head with release semantics after storing data; the reader must load
+ * head with acquire semantics and store tail with release semantics once it is done.
+ * poll() reports EPOLLIN while head != tail.
+ */
+#define UART_MMAP_DATA_SIZE (64 * 1024)
+
+struct uart_mmap_ring {
+    __u32 head;        // Written by the driver: bytes produced so far
+    __u32 tail;        // Written by the reader: bytes consumed so far
+    __u32 size;        // Size of the data area (a power of two)
+    __u32 data_offset; // Offset of the data area from the start of the mapping
+};
+
+#endif
@@ -1,16 +1,48 @@
-/*pseudo code                                                                                                                                                                1. Define base address for UART0 and other necessary constants.
+/*pseudo code                                                                                                                                                                1. Define the PL011 register offsets and other necessary constants.
 2. Define GPIO pin for controlling LED (e.g., GPIO pin 529).
 3. Implement file operations for the UART device (open, read, write, close).
-   - Implement uart_open(): This is invoked when the device is opened.
-   - Implement uart_write(): This handles writing data to the UART device.
-   - Implement uart_read(): This handles reading data from the UART device and controlling the LED based on the command received.
+   - Implement uart_open(): This is invoked when the device is opened and picks the port from the minor number.
+   - Implement uart_write(): This copies data in bulk into the TX ring buffer and returns once it is queued.
+   - Implement uart_read(): This sleeps until the RX ring buffer has data and copies out as many
+     bytes as the caller asked for. After UART_IOC_SET_RX_TSTAMP it returns packed
+     (timestamp, length, bytes) records instead, one per RX pickup or per delimiter.
+   - Implement uart_poll(): This reports EPOLLIN while RX data is buffered and EPOLLOUT while the
+     TX ring has room; O_NONBLOCK reads and writes return -EAGAIN instead of sleeping.
+   - Implement uart_mmap(): This maps a header page with head/tail indices plus data pages; while
+     mapped, received bytes go straight into it and poll() is used only for wakeups.
+   - Implement uart_fsync() / TCSBRK (tcdrain()): These wait until the queued data is on the wire.
    - Implement uart_close(): This is invoked when the device is closed.
-4. Initialize the UART registers, configure the GPIO pin, and register the device.
+4. Implement the UART interrupt handler:
+   - On an RX (FIFO level) or RX timeout interrupt, drain the hardware FIFO into the kfifo ring buffer.
+   - Wake up any reader sleeping on the RX wait queue.
+   - Feed every received byte to the command tokenizer: newline-terminated "ON", "OFF", "TOGGLE"
+     and "PULSE [ms]" drive the LED right there and are acknowledged with the resulting LED state
+     ("1\n" / "0\n", "E\n" for an unknown command) without a trip through user space.
+     UART_IOC_GET_CMD_STATS returns a log2 histogram of the interrupt-to-LED latency.
+   - On a TX interrupt, refill the TX FIFO from the TX ring buffer and wake up waiting writers.
+   - Count overrun, framing, parity and break errors from the Data Register error bits
+     (UART_IOC_GET_ERRORS reads them back).
+   - With RTS/CTS flow control, deassert RTS above the RX ring high watermark; uart_read()
+     reasserts it below the low watermark. CTS gates the transmitter in hardware.
+   - With polling=1 uart_read() and uart_write() poll the Flag Register instead of using the IRQ.
+   - With dma=1, large TX backlogs are handed to a dmaengine channel and RX runs continuously into
+     two alternating DMA buffers; the RX timeout interrupt flushes a partly filled buffer.
+     Without DMA channels the driver stays on the interrupt path.
+5. Probe every PL011 the device tree describes. Each port gets its own state (registers, IRQ,
+   ring buffers, locks) and its own /dev/uartN node, so ports never contend with each other.
+   N follows the board's serialN alias where there is one.
    - Map the UART registers into virtual memory.
-   - Set up the UART parameters (baud rate, 8N1 format, etc.).
-   - Request and configure the GPIO pin for output to control the LED.
-5. Clean up resources when the module is removed:
-   - Unregister the device, unmap the UART base address, and release the GPIO pin.*/
+   - Set up the UART parameters (baud rate derived from the port's UARTCLK, 8N1 format, etc.).
+     UART_IOC_SET_LINE changes baud rate, data bits, parity and stop bits at runtime.
+   - Request the UART IRQ and unmask the RX and RX timeout interrupts (TX only while data is queued).
+6. At module load, request and configure the GPIO pin for output to control the LED
+   (shared by all ports) and register the driver.
+7. Clean up resources when a port is removed or the module is unloaded:
+   - Mask the interrupts, release the DMA channels and remove the device node.
+   - Unregister the driver and release the GPIO pin.
+
+Testing on QEMU (-M virt): unbind the stock driver from the PL011 first, then load the module
+   echo 9000000.pl011 > /sys/bus/amba/drivers/uart-pl011/unbind; insmod uart_rx_data.ko*/
 
 
 
@@ -25,153 +57,1561 @@
 #include <linux/fs.h>          // For file operations like open(), read(), write()
 #include <linux/uaccess.h>     // For copy_from_user() and copy_to_user()
 #include <linux/device.h>      // For creating device files
+#include <linux/cdev.h>        // For one character device per port
+#include <linux/amba/bus.h>    // For binding to the PL011 instances in the device tree
+#include <linux/clk.h>         // For the per-port UART reference clock
+#include <linux/of.h>          // For the serialN aliases that pick the minor number
+#include <linux/idr.h>         // For allocating minor numbers
+#include <linux/gpio.h>        // For gpio_request() and gpio_set_value() to drive the LED
+#include <linux/interrupt.h>   // For request_irq() and the UART interrupt handler
+#include <linux/kfifo.h>       // For the RX and TX ring buffers shared with the interrupt handler
+#include <linux/wait.h>        // For the wait queue uart_read() sleeps on
+#include <linux/mutex.h>       // For serialising readers and writers of the ring buffers
+#include <linux/spinlock.h>    // For protecting the TX ring buffer against the interrupt handler
+#include <linux/delay.h>       // For usleep_range() while the transmitter drains
+#include <linux/poll.h>        // For poll()/select()/epoll() readiness reporting
+#include <linux/dmaengine.h>   // For the optional DMA transfer mode
+#include <linux/dma-mapping.h> // For the coherent DMA buffers
+#include <linux/vmalloc.h>     // For the mmap-able RX ring
+#include <linux/mm.h>          // For remap_vmalloc_range() and the vm_operations of the mapping
+#include <linux/math64.h>     // For the 64-bit baud rate divisor arithmetic
+#include <asm/ioctls.h>        // For TCSBRK, which tcdrain() issues
+#include <linux/sched/signal.h> // For signal_pending() in the polling fallback
+#include <linux/hrtimer.h>     // For ending an LED pulse without sleeping in the RX path
+#include <linux/ktime.h>       // For timestamping received commands and records
+#include <linux/log2.h>        // For the latency histogram buckets
+#include <linux/percpu.h>      // For the per-CPU statistics
+#include <linux/debugfs.h>     // For publishing the statistics
+#include <linux/seq_file.h>    // For formatting the statistics file
+
+#include "uart_ioctl.h"        // For the line configuration ioctl shared with user space
 
-#define UART0_BASE   0x3F201000 // Base address for UART0 (Raspberry Pi 3/4)
-#define UART_REG_SIZE 0x1000    // Memory size to map for UART registers
+#define UART_MAX_PORTS 8 // Minor numbers reserved for PL011 instances
 
 #define LED 529  // Define GPIO pin for LED (use an appropriate GPIO pin for your platform)
 
 // UART Register Offsets
 #define UART_DR      0x00 // Data Register
+#define UART_RSR     0x04 // Receive Status Register / Error Clear Register
 #define UART_FR      0x18 // Flag Register
 #define UART_IBRD    0x24 // Integer Baud Rate Divisor
 #define UART_FBRD    0x28 // Fractional Baud Rate Divisor
 #define UART_LCRH    0x2C // Line Control Register
 #define UART_CR      0x30 // Control Register
+#define UART_IFLS    0x34 // Interrupt FIFO Level Select Register
 #define UART_IMSC    0x38 // Interrupt Mask Set/Clear Register
+#define UART_MIS     0x40 // Masked Interrupt Status Register
+#define UART_ICR     0x44 // Interrupt Clear Register
+#define UART_DMACR   0x48 // DMA Control Register
 
 // UART Flags
+#define UART_FR_TXFE 0x80 // Transmit FIFO Empty
 #define UART_FR_TXFF 0x20 // Transmit FIFO Full
 #define UART_FR_RXFE 0x10 // Receive FIFO Empty
+#define UART_FR_BUSY 0x08 // UART Busy (set until the last stop bit has left the shift register)
+
+// UART Data Register error bits (bits 8-11 mirror the Receive Status Register bits 0-3)
+#define UART_DR_FE   (1 << 8)  // Framing error
+#define UART_DR_PE   (1 << 9)  // Parity error
+#define UART_DR_BE   (1 << 10) // Break error
+#define UART_DR_OE   (1 << 11) // Overrun error
+#define UART_DR_ERROR (UART_DR_FE | UART_DR_PE | UART_DR_BE | UART_DR_OE)
+
+#define UART_RSR_FE  (1 << 0)  // Framing error
+#define UART_RSR_PE  (1 << 1)  // Parity error
+#define UART_RSR_BE  (1 << 2)  // Break error
+#define UART_RSR_OE  (1 << 3)  // Overrun error
+
+// UART Control bits
+#define UART_CR_RTS   (1 << 11) // Assert nRTS (ready to receive)
+#define UART_CR_CTSEN (1 << 15) // Hardware CTS flow control: TX only while nCTS is asserted
+
+// UART Line Control bits
+#define UART_LCRH_PEN  (1 << 1) // Parity enable
+#define UART_LCRH_EPS  (1 << 2) // Even parity select
+#define UART_LCRH_STP2 (1 << 3) // Two stop bits
+#define UART_LCRH_FEN  (1 << 4) // Enable the TX and RX FIFOs
+#define UART_LCRH_WLEN(bits) (((bits) - 5) << 5) // Word length, 5 to 8 data bits
+
+// UART Interrupt bits (same layout in IMSC, MIS and ICR)
+#define UART_INT_RX  (1 << 4) // Receive interrupt (RX FIFO reached its trigger level)
+#define UART_INT_TX  (1 << 5) // Transmit interrupt (TX FIFO dropped to its trigger level)
+#define UART_INT_RT  (1 << 6) // Receive timeout interrupt (data idle in the RX FIFO)
+#define UART_INT_ERR (0xF << 7) // Framing, parity, break and overrun error interrupts
+
+#define UART_IFLS_RX4_8 (2 << 3) // Raise the RX interrupt when the RX FIFO is half full
+#define UART_IFLS_TX4_8 (2 << 0) // Raise the TX interrupt when the TX FIFO is half empty
+
+// UART DMA Control bits
+#define UART_DMACR_RXDMAE   (1 << 0) // Enable DMA requests for the RX FIFO
+#define UART_DMACR_TXDMAE   (1 << 1) // Enable DMA requests for the TX FIFO
+
+#define UART_RX_BUF_SIZE 4096 // Size of the RX ring buffer (must be a power of two)
+#define UART_TX_BUF_SIZE 4096 // Size of the TX ring buffer (must be a power of two)
+#define UART_RX_HIGH_WATER (UART_RX_BUF_SIZE * 3 / 4) // Deassert RTS above this ring fill level
+#define UART_RX_LOW_WATER  (UART_RX_BUF_SIZE / 4)     // Reassert RTS below this ring fill level
+#define UART_READ_CHUNK  256  // Bytes moved from the RX ring buffer per copy_to_user()
+#define UART_WRITE_CHUNK 256  // Bytes moved into the TX ring buffer per copy_from_user()
+#define UART_DMA_BUF_SIZE 4096 // Size of each DMA bounce buffer
+#define UART_DMA_BURST   8     // DMA burst length, matches the half-full FIFO levels
+#define UART_DMA_TX_MIN  16    // Shorter TX backlogs go through the TX FIFO interrupt instead
+#define UART_LAT_BUCKETS 32    // log2(ns) latency buckets, the last one also takes anything slower
+#define UART_CMD_MAX     16    // Longest command line the tokenizer accepts, terminator included
+#define UART_PULSE_MS    100   // LED pulse length when "PULSE" carries no argument
+#define UART_RX_MARKS    256   // Closed timestamp records waiting for the reader (power of two)
+
+static bool polling; // Ignore the IRQ and poll the Flag Register (baseline for comparisons)
+module_param(polling, bool, 0444);
+MODULE_PARM_DESC(polling, "Poll the Flag Register instead of using the PL011 IRQ");
+
+static unsigned int uartclk = 48000000; // Used when the device tree gives no "uartclk" clock
+module_param(uartclk, uint, 0444);
+MODULE_PARM_DESC(uartclk, "Fallback UART reference clock in Hz (Raspberry Pi firmware default 48 MHz)");
+
+static unsigned int baud = 115200; // Line rate programmed when a port is probed
+module_param(baud, uint, 0444);
+MODULE_PARM_DESC(baud, "Initial baud rate (8N1); change at runtime with UART_IOC_SET_LINE");
+
+static bool crtscts; // Start with RTS/CTS hardware flow control enabled
+module_param(crtscts, bool, 0444);
+MODULE_PARM_DESC(crtscts, "Initial RTS/CTS flow control; change at runtime with UART_IOC_SET_LINE");
+
+static bool dma; // Hand bulk TX and continuous RX to a dmaengine channel
+module_param(dma, bool, 0444);
+MODULE_PARM_DESC(dma, "Use DMA for bulk transfers (not with polling; falls back to the IRQ path)");
+
+static bool collect_stats = true; // Per-port statistics in debugfs (uart/uartN/stats)
+module_param(collect_stats, bool, 0644);
+MODULE_PARM_DESC(collect_stats, "Collect per-port statistics; can be switched at runtime");
+
+// DMA mode: one TX buffer and two RX buffers that the RX channel fills alternately
+struct uart_dma_buf {
+    char *buf;        // CPU address of the coherent buffer
+    dma_addr_t addr;  // Bus address handed to the DMA engine
+};
+
+// Timestamp and length of a run of bytes in rx_fifo (timestamped read mode)
+struct uart_rx_mark {
+    ktime_t stamp;     // Pickup of the first byte
+    u32 len;           // Bytes of the run still in rx_fifo
+    u32 flags;         // UART_RX_REC_*
+};
+
+// Per-CPU statistics: each CPU only updates its own copy, so counting needs no lock or atomic
+struct uart_stats {
+    u64 rx_bytes;      // Bytes taken from the RX FIFO or the RX DMA buffers
+    u64 tx_bytes;      // Bytes handed to the TX FIFO or the TX DMA engine
+    u64 irqs;          // Interrupts that were ours
+    u64 rx_wakeups;    // Blocked readers woken by received data
+    u64 tx_wakeups;    // Blocked writers and drainers woken by the transmitter
+    u64 rx_fifo_hwm;   // Most bytes drained from the hardware RX FIFO in one pass
+    u64 rx_ring_hwm;   // Highest RX ring fill level
+    u64 tx_ring_hwm;   // Highest TX ring fill level
+    u64 read_latency[UART_LAT_BUCKETS]; // RX interrupt to read() returning the byte, log2(ns)
+};
+
+// Everything one PL011 instance needs; nothing on the data path is shared between ports
+struct uart_dev {
+    struct device *dev;                      // The PL011 the device tree describes
+    void __iomem *base;                      // Pointer to the base address of UART registers
+    resource_size_t phys_base;               // Physical address, for the DMA slave configuration
+    int irq;                                 // Linux IRQ number, -1 in polling mode
+    unsigned int uartclk;                    // Reference clock the divisors are computed from
+    int minor;                               // Minor number of /dev/uartN
+    struct cdev cdev;                        // Character device of this port
+
+    // RX side: filled by the interrupt handler, drained by uart_read()
+    DECLARE_KFIFO(rx_fifo, char, UART_RX_BUF_SIZE); // Bytes received but not yet read
+    wait_queue_head_t rx_wait;               // Readers sleep here until data arrives
+    struct mutex rx_lock;                    // Only one reader drains the ring at a time
+    char rx_chunk[UART_READ_CHUNK];          // Bounce buffer, protected by rx_lock
+    struct uart_rx_errors rx_errors;         // Error and drop counters (lock)
+    bool rx_throttled;                       // RTS deasserted at the high watermark (lock)
+
+    // Timestamped read mode: rx_marks splits rx_fifo into records
+    u8 rx_tstamp;                            // UART_RX_TSTAMP_* (lock and rx_lock)
+    u8 rx_delim;                             // Record terminator in UART_RX_TSTAMP_DELIM mode
+    DECLARE_KFIFO(rx_marks, struct uart_rx_mark, UART_RX_MARKS); // Closed records, oldest first
+    struct uart_rx_mark rx_open;             // Record the RX path is filling (lock)
+    struct uart_rx_mark rx_rd;               // Rest of the record read() is handing out (rx_lock)
+
+    // Zero-copy RX: while mapped, received bytes go to this shared ring instead of rx_fifo
+    struct uart_mmap_ring *rx_ring;          // Header page, allocated on the first mmap()
+    char *rx_ring_data;                      // Data pages following the header page
+    bool rx_ring_active;                     // Ring is mapped and receiving (lock)
+    int rx_ring_maps;                        // Number of live mappings (rx_ring_lock)
+    struct mutex rx_ring_lock;               // Serialises mmap() and unmapping
+
+    // TX side: filled by uart_write(), drained by the interrupt handler
+    DECLARE_KFIFO(tx_fifo, char, UART_TX_BUF_SIZE); // Bytes queued but not yet in the TX FIFO
+    wait_queue_head_t tx_wait;               // Writers wait here for space or for a drain
+    struct mutex tx_lock;                    // Serialises writers (and tx_chunk)
+    char tx_chunk[UART_WRITE_CHUNK];         // Bounce buffer, protected by tx_lock
+    spinlock_t lock;                         // Protects IRQ-side ring access and imsc
+    u32 imsc;                                // Shadow of the interrupt mask register
+
+    struct dma_chan *dma_tx_chan, *dma_rx_chan; // NULL when DMA is off or unavailable
+    struct uart_dma_buf dma_tx_buf, dma_rx_buf[2];
+    bool dma_tx_busy;                        // TX descriptor in flight (lock)
+    bool dma_rx_running;                     // RX descriptor in flight (lock)
+    int dma_rx_cur;                          // RX buffer the running descriptor fills
+    dma_cookie_t dma_rx_cookie;              // Cookie of the running RX descriptor
+    u32 dmacr;                               // Shadow of the DMA control register
+
+    struct uart_line_config line_cfg;        // Line settings currently programmed (lock)
+
+    struct uart_stats __percpu *stats;       // Counters behind debugfs uart/uartN/stats
+    struct dentry *debugfs;                  // debugfs uart/uartN directory
+    ktime_t rx_stamp;                        // When the RX path picked up the current bytes
+    ktime_t rx_oldest;                       // When the oldest byte in rx_fifo was picked up
+
+    // Command tokenizer, fed from the RX path under lock
+    char cmd_buf[UART_CMD_MAX];              // Current command line, NUL-terminated on execution
+    unsigned int cmd_len;                    // Bytes collected in cmd_buf
+    bool cmd_overflow;                       // Line too long, skip it up to the next newline
+    struct uart_cmd_stats cmd_stats;         // Command counters and latency histogram
+};
+
+// The LED is shared by all ports, so a command on any of them drives it
+static DEFINE_SPINLOCK(led_lock);            // Protects led_on; nests inside a port's lock
+static bool led_on;                          // Current LED state (led_lock)
+static struct hrtimer led_pulse_timer;       // Turns the LED off at the end of a PULSE
+
+static dev_t uart_devt;                      // First of the UART_MAX_PORTS device numbers
+static struct class *uart_class;             // Class for the UART devices
+static DEFINE_IDA(uart_minors);              // Minor numbers in use
+static struct dentry *uart_debugfs;          // debugfs uart directory
+
+#define UART_STAT_ADD(port, field, n) do {                 \
+    if (READ_ONCE(collect_stats))                           \
+        this_cpu_add((port)->stats->field, (n));            \
+} while (0)
+
+#define UART_STAT_MAX(port, field, v) do {                 \
+    if (READ_ONCE(collect_stats) && (v) > this_cpu_read((port)->stats->field)) \
+        this_cpu_write((port)->stats->field, (v));          \
+} while (0)
+
+// Latency histogram bucket: floor(log2(ns)), capped at the last bucket
+static unsigned int uart_lat_bucket(s64 ns) {
+    return ns > 0 ? min_t(unsigned int, ilog2((u64)ns), UART_LAT_BUCKETS - 1) : 0;
+}
+
+// Count the receive errors flagged in RSR layout (DR error bits shifted down by 8)
+static void uart_rx_count_errors(struct uart_dev *port, u32 rsr) {
+    if (rsr & UART_RSR_OE)
+        port->rx_errors.overrun++;
+    if (rsr & UART_RSR_BE)
+        port->rx_errors.brk++;
+    else if (rsr & UART_RSR_FE) // A break also raises the framing error, count it once
+        port->rx_errors.framing++;
+    if (rsr & UART_RSR_PE)
+        port->rx_errors.parity++;
+}
+
+// Bytes waiting for the reader, in whichever ring is receiving
+static unsigned int uart_rx_fill(struct uart_dev *port) {
+    if (READ_ONCE(port->rx_ring_active))
+        return READ_ONCE(port->rx_ring->head) - smp_load_acquire(&port->rx_ring->tail);
+    return kfifo_len(&port->rx_fifo);
+}
+
+// Deassert RTS once the ring buffer crosses the high watermark (caller holds port->lock)
+static void uart_rx_throttle(struct uart_dev *port) {
+    unsigned int high = port->rx_ring_active ? UART_MMAP_DATA_SIZE * 3 / 4 : UART_RX_HIGH_WATER;
+
+    if (port->line_cfg.flow != UART_FLOW_RTSCTS || port->rx_throttled || uart_rx_fill(port) < high)
+        return;
+
+    writel(readl(port->base + UART_CR) & ~UART_CR_RTS, port->base + UART_CR);
+    port->rx_throttled = true;
+    port->rx_errors.throttled++;
+}
+
+// Reassert RTS once the reader has brought the ring buffer below the low watermark
+static void uart_rx_unthrottle(struct uart_dev *port) {
+    unsigned int low = port->rx_ring_active ? UART_MMAP_DATA_SIZE / 4 : UART_RX_LOW_WATER;
+    unsigned long flags;
+
+    if (!READ_ONCE(port->rx_throttled))
+        return;
+
+    spin_lock_irqsave(&port->lock, flags);
+    if (port->rx_throttled && uart_rx_fill(port) <= low) {
+        writel(readl(port->base + UART_CR) | UART_CR_RTS, port->base + UART_CR);
+        port->rx_throttled = false;
+    }
+    spin_unlock_irqrestore(&port->lock, flags);
+}
+
+static void uart_cmd_feed(struct uart_dev *port, const char *data, unsigned int len);
+
+// Publish the open record to the reader; if rx_marks is full it stays open and keeps growing
+// (caller holds port->lock)
+static void uart_rx_mark_close(struct uart_dev *port) {
+    if (port->rx_open.len && kfifo_put(&port->rx_marks, port->rx_open))
+        memset(&port->rx_open, 0, sizeof(port->rx_open));
+}
+
+// Account stored bytes of data to the open record, closing it at each delimiter
+// (caller holds port->lock)
+static void uart_rx_mark(struct uart_dev *port, const char *data, unsigned int stored, unsigned int len) {
+    struct uart_rx_mark *rec = &port->rx_open;
+    unsigned int i;
+
+    if (stored < len)
+        rec->flags |= UART_RX_REC_DROPPED;
+
+    if (port->rx_tstamp == UART_RX_TSTAMP_CHUNK) {
+        if (stored && !rec->len)
+            rec->stamp = port->rx_stamp;
+        rec->len += stored; // Closed at the end of the pickup
+        return;
+    }
+
+    for (i = 0; i < stored; i++) {
+        if (!rec->len)
+            rec->stamp = port->rx_stamp;
+        rec->len++;
+        if (data[i] == port->rx_delim || rec->len >= UART_RX_RECORD_MAX)
+            uart_rx_mark_close(port);
+    }
+}
+
+// End of one pickup of the receive path: a chunk record is complete (caller holds port->lock)
+static void uart_rx_mark_pickup(struct uart_dev *port) {
+    if (port->rx_tstamp == UART_RX_TSTAMP_CHUNK)
+        uart_rx_mark_close(port);
+}
+
+// Hand received bytes to the reader: the mmap ring if it is mapped, rx_fifo otherwise
+// (caller holds port->lock)
+static void uart_rx_push(struct uart_dev *port, const char *data, unsigned int len) {
+    struct uart_mmap_ring *ring = port->rx_ring;
+    unsigned int n = len;
+    u32 head, space, first;
+
+    if (!port->rx_ring_active) {
+        if (kfifo_is_empty(&port->rx_fifo))
+            port->rx_oldest = port->rx_stamp; // read() latency starts at this pickup
+        n = kfifo_in(&port->rx_fifo, data, len);
+        if (port->rx_tstamp)
+            uart_rx_mark(port, data, n, len);
+    } else {
+        head = ring->head;
+        space = UART_MMAP_DATA_SIZE - (head - smp_load_acquire(&ring->tail));
+        n = min(len, space);
+        first = min(n, UART_MMAP_DATA_SIZE - (head & (UART_MMAP_DATA_SIZE - 1)));
+        memcpy(port->rx_ring_data + (head & (UART_MMAP_DATA_SIZE - 1)), data, first);
+        memcpy(port->rx_ring_data, data + first, n - first); // Wrap around to the start of the data area
+        smp_store_release(&ring->head, head + n);           // Publish the bytes to the reader
+    }
+
+    port->rx_errors.dropped += len - n; // Whatever did not fit is lost
+    UART_STAT_ADD(port, rx_bytes, len);
+    UART_STAT_MAX(port, rx_ring_hwm, uart_rx_fill(port));
+    uart_cmd_feed(port, data, len);     // Commands are acted on even if the reader is behind
+}
+
+// Move everything currently in the hardware RX FIFO into the ring buffer (caller holds port->lock)
+static void uart_rx_drain(struct uart_dev *port) {
+    char burst[32]; // Collected bytes are published to the reader in one go
+    unsigned int n = 0, total = 0;
+
+    while (!(readl(port->base + UART_FR) & UART_FR_RXFE)) {
+        u32 dr = readl(port->base + UART_DR); // Read one byte and its error flags from the Data Register
+
+        if (dr & UART_DR_ERROR) {
+            uart_rx_count_errors(port, dr >> 8);
+            if (dr & UART_DR_BE)
+                continue; // A break carries no data byte
+        }
+
+        burst[n++] = dr & 0xFF;
+        total++;
+        if (n == sizeof(burst)) {
+            uart_rx_push(port, burst, n);
+            n = 0;
+        }
+    }
+
+    if (n)
+        uart_rx_push(port, burst, n);
+    UART_STAT_MAX(port, rx_fifo_hwm, total);
+    uart_rx_mark_pickup(port);
+    uart_rx_throttle(port);
+}
+
+// Drain the RX FIFO from process context (polling mode)
+static void uart_rx_poll_drain(struct uart_dev *port) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&port->lock, flags);
+    port->rx_stamp = ktime_get();
+    uart_rx_drain(port);
+    spin_unlock_irqrestore(&port->lock, flags);
+}
+
+static void uart_tx_pump(struct uart_dev *port);
+
+// Request a slave channel that can be paced by the PL011 DMA request lines
+static struct dma_chan *uart_dma_request(struct uart_dev *port, enum dma_transfer_direction dir) {
+    struct dma_slave_config cfg = {
+        .direction = dir,
+        .src_addr = port->phys_base + UART_DR,      // RX reads the Data Register
+        .src_addr_width = DMA_SLAVE_BUSWIDTH_1_BYTE,
+        .src_maxburst = UART_DMA_BURST,
+        .dst_addr = port->phys_base + UART_DR,      // TX writes the Data Register
+        .dst_addr_width = DMA_SLAVE_BUSWIDTH_1_BYTE,
+        .dst_maxburst = UART_DMA_BURST,
+    };
+    struct dma_chan *chan;
+    dma_cap_mask_t mask;
+
+    // Prefer the channels the device tree wires to this port ("dmas"/"dma-names")
+    chan = dma_request_chan(port->dev, dir == DMA_MEM_TO_DEV ? "tx" : "rx");
+    if (IS_ERR(chan)) {
+        dma_cap_zero(mask);
+        dma_cap_set(DMA_SLAVE, mask);
+        chan = dma_request_chan_by_mask(&mask);
+        if (IS_ERR(chan))
+            return NULL;
+    }
+
+    if (dmaengine_slave_config(chan, &cfg)) {
+        dma_release_channel(chan);
+        return NULL;
+    }
+    return chan;
+}
+
+// Completion of a TX descriptor: hand the transmitter back to uart_tx_pump()
+static void uart_dma_tx_callback(void *param) {
+    struct uart_dev *port = param;
+    unsigned long flags;
+
+    spin_lock_irqsave(&port->lock, flags);
+    port->dmacr &= ~UART_DMACR_TXDMAE;
+    writel(port->dmacr, port->base + UART_DMACR);
+    port->dma_tx_busy = false;
+    uart_tx_pump(port); // Next chunk goes out by DMA or, if short, through the TX FIFO interrupt
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    wake_up_interruptible(&port->tx_wait); // Ring buffer space was freed
+}
+
+// Move up to one DMA buffer from the TX ring to the DMA engine (caller holds port->lock)
+static int uart_dma_tx_start(struct uart_dev *port) {
+    struct dma_async_tx_descriptor *desc;
+    unsigned int len = min_t(unsigned int, kfifo_len(&port->tx_fifo), UART_DMA_BUF_SIZE);
+
+    // The descriptor only reads the buffer once issued, so prepare it before consuming the ring
+    desc = dmaengine_prep_slave_single(port->dma_tx_chan, port->dma_tx_buf.addr, len, DMA_MEM_TO_DEV,
+                                       DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+    if (!desc)
+        return -EBUSY; // Channel busy, keep using the TX FIFO interrupt
+
+    len = kfifo_out(&port->tx_fifo, port->dma_tx_buf.buf, len);
+    UART_STAT_ADD(port, tx_bytes, len);
+    desc->callback = uart_dma_tx_callback;
+    desc->callback_param = port;
+    dmaengine_submit(desc);
+
+    port->dma_tx_busy = true;
+    port->imsc &= ~UART_INT_TX; // The DMA completion replaces the TX FIFO interrupt
+    writel(port->imsc, port->base + UART_IMSC);
+    port->dmacr |= UART_DMACR_TXDMAE;
+    writel(port->dmacr, port->base + UART_DMACR);
+    dma_async_issue_pending(port->dma_tx_chan);
+
+    return 0;
+}
+
+// Push the first len bytes of an RX DMA buffer into the ring buffer (caller holds port->lock)
+static void uart_dma_rx_push(struct uart_dev *port, struct uart_dma_buf *b, size_t len) {
+    uart_rx_push(port, b->buf, len);
+    uart_rx_throttle(port);
+}
+
+static void uart_dma_rx_callback(void *param);
+
+// Start an RX descriptor on the current buffer; falls back to the RX interrupt on failure
+// (caller holds port->lock)
+static void uart_dma_rx_start(struct uart_dev *port) {
+    struct dma_async_tx_descriptor *desc;
+
+    desc = dmaengine_prep_slave_single(port->dma_rx_chan, port->dma_rx_buf[port->dma_rx_cur].addr,
+                                       UART_DMA_BUF_SIZE, DMA_DEV_TO_MEM,
+                                       DMA_PREP_INTERRUPT | DMA_CTRL_ACK);
+    if (!desc) {
+        port->dma_rx_running = false;
+        port->dmacr &= ~UART_DMACR_RXDMAE;
+        writel(port->dmacr, port->base + UART_DMACR);
+        port->imsc |= UART_INT_RX; // Back to draining the RX FIFO from the interrupt handler
+        writel(port->imsc, port->base + UART_IMSC);
+        return;
+    }
+
+    desc->callback = uart_dma_rx_callback;
+    desc->callback_param = port;
+    port->dma_rx_cookie = dmaengine_submit(desc);
+    dma_async_issue_pending(port->dma_rx_chan);
+    port->dma_rx_running = true;
+
+    port->dmacr |= UART_DMACR_RXDMAE;
+    writel(port->dmacr, port->base + UART_DMACR);
+    port->imsc &= ~UART_INT_RX; // Full bursts go to DMA, the RX timeout still flushes partial buffers
+    writel(port->imsc, port->base + UART_IMSC);
+}
+
+// A whole RX buffer was filled: restart on the other buffer first, then hand this one over
+static void uart_dma_rx_callback(void *param) {
+    struct uart_dev *port = param;
+    struct uart_dma_buf *done;
+    unsigned long flags;
+
+    spin_lock_irqsave(&port->lock, flags);
+    // A descriptor terminated by the RX timeout flush may still report completion
+    if (!port->dma_rx_running ||
+        dmaengine_tx_status(port->dma_rx_chan, port->dma_rx_cookie, NULL) != DMA_COMPLETE) {
+        spin_unlock_irqrestore(&port->lock, flags);
+        return;
+    }
+
+    port->rx_stamp = ktime_get();
+    done = &port->dma_rx_buf[port->dma_rx_cur];
+    port->dma_rx_cur ^= 1;
+    uart_dma_rx_start(port);
+    uart_dma_rx_push(port, done, UART_DMA_BUF_SIZE);
+    uart_rx_mark_pickup(port);
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    wake_up_interruptible(&port->rx_wait); // Wake up readers waiting for data
+}
+
+// RX timeout: stop the running descriptor, hand over what it has received so far and
+// restart on the other buffer (caller holds port->lock)
+static void uart_dma_rx_flush(struct uart_dev *port) {
+    struct uart_dma_buf *done = &port->dma_rx_buf[port->dma_rx_cur];
+    struct dma_tx_state state;
+
+    dmaengine_pause(port->dma_rx_chan);
+    dmaengine_tx_status(port->dma_rx_chan, port->dma_rx_cookie, &state);
+    dmaengine_terminate_async(port->dma_rx_chan);
+    port->dma_rx_running = false;
+
+    uart_dma_rx_push(port, done, UART_DMA_BUF_SIZE - state.residue);
+    uart_rx_drain(port); // Bytes below the DMA burst size are still in the RX FIFO
+
+    port->dma_rx_cur ^= 1;
+    uart_dma_rx_start(port);
+}
+
+// Release whatever uart_dma_init() managed to set up
+static void uart_dma_release(struct uart_dev *port) {
+    port->dmacr = 0;
+    writel(port->dmacr, port->base + UART_DMACR);
+
+    if (port->dma_rx_chan) {
+        dmaengine_terminate_sync(port->dma_rx_chan);
+        for (int i = 0; i < 2; i++)
+            if (port->dma_rx_buf[i].buf)
+                dma_free_coherent(port->dma_rx_chan->device->dev, UART_DMA_BUF_SIZE,
+                                  port->dma_rx_buf[i].buf, port->dma_rx_buf[i].addr);
+        dma_release_channel(port->dma_rx_chan);
+        port->dma_rx_chan = NULL;
+    }
+
+    if (port->dma_tx_chan) {
+        dmaengine_terminate_sync(port->dma_tx_chan);
+        if (port->dma_tx_buf.buf)
+            dma_free_coherent(port->dma_tx_chan->device->dev, UART_DMA_BUF_SIZE,
+                              port->dma_tx_buf.buf, port->dma_tx_buf.addr);
+        dma_release_channel(port->dma_tx_chan);
+        port->dma_tx_chan = NULL;
+    }
+
+    memset(port->dma_rx_buf, 0, sizeof(port->dma_rx_buf));
+    memset(&port->dma_tx_buf, 0, sizeof(port->dma_tx_buf));
+}
+
+// Set up the TX channel and the double-buffered RX channel; any failure leaves the IRQ path
+static int uart_dma_init(struct uart_dev *port) {
+    unsigned long flags;
+
+    port->dma_tx_chan = uart_dma_request(port, DMA_MEM_TO_DEV);
+    port->dma_rx_chan = uart_dma_request(port, DMA_DEV_TO_MEM);
+    if (!port->dma_tx_chan || !port->dma_rx_chan)
+        goto fail;
+
+    port->dma_tx_buf.buf = dma_alloc_coherent(port->dma_tx_chan->device->dev, UART_DMA_BUF_SIZE,
+                                              &port->dma_tx_buf.addr, GFP_KERNEL);
+    if (!port->dma_tx_buf.buf)
+        goto fail;
+
+    for (int i = 0; i < 2; i++) {
+        port->dma_rx_buf[i].buf = dma_alloc_coherent(port->dma_rx_chan->device->dev, UART_DMA_BUF_SIZE,
+                                                     &port->dma_rx_buf[i].addr, GFP_KERNEL);
+        if (!port->dma_rx_buf[i].buf)
+            goto fail;
+    }
+
+    spin_lock_irqsave(&port->lock, flags);
+    port->dmacr = 0;
+    writel(port->dmacr, port->base + UART_DMACR);
+    port->imsc |= UART_INT_ERR; // DMA reads bypass the DR error bits, count errors from RSR instead
+    port->dma_rx_cur = 0;
+    uart_dma_rx_start(port);
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    return 0;
+
+fail:
+    uart_dma_release(port);
+    return -ENODEV;
+}
+
+// Refill the TX FIFO from the ring buffer; the TX interrupt stays enabled while data is pending
+// (caller holds port->lock)
+static void uart_tx_pump(struct uart_dev *port) {
+    unsigned int sent = 0;
+    char c;
+
+    if (port->dma_tx_busy)
+        return; // The DMA engine owns the transmitter until its callback runs
+
+    // Large backlogs go out by DMA, one buffer per descriptor
+    if (port->dma_tx_chan && kfifo_len(&port->tx_fifo) > UART_DMA_TX_MIN && !uart_dma_tx_start(port))
+        return;
+
+    while (!(readl(port->base + UART_FR) & UART_FR_TXFF) && kfifo_get(&port->tx_fifo, &c)) {
+        writel(c, port->base + UART_DR); // Write the character to the UART Data Register
+        sent++;
+    }
+    UART_STAT_ADD(port, tx_bytes, sent);
+
+    if (port->irq < 0)
+        return; // Polling mode: the writer keeps pumping itself
+
+    if (kfifo_is_empty(&port->tx_fifo))
+        port->imsc &= ~UART_INT_TX; // Nothing left to send, stop TX interrupts
+    else
+        port->imsc |= UART_INT_TX;  // Come back when the TX FIFO is half empty
+    writel(port->imsc, port->base + UART_IMSC);
+}
+
+// Queue kernel data for transmission, returns the number of bytes accepted
+static unsigned int uart_tx_queue(struct uart_dev *port, const char *data, unsigned int len) {
+    unsigned long flags;
+    unsigned int n;
+
+    spin_lock_irqsave(&port->lock, flags);
+    n = kfifo_in(&port->tx_fifo, data, len);
+    UART_STAT_MAX(port, tx_ring_hwm, kfifo_len(&port->tx_fifo));
+    uart_tx_pump(port); // Start the transmitter right away
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    return n;
+}
+
+// Drive the LED (caller holds led_lock)
+static void uart_led_set(bool on) {
+    gpio_set_value(LED, on); // Memory-mapped GPIO, safe in interrupt context
+    led_on = on;
+}
+
+// End of an LED pulse
+static enum hrtimer_restart uart_led_pulse_end(struct hrtimer *timer) {
+    unsigned long flags;
+
+    spin_lock_irqsave(&led_lock, flags);
+    uart_led_set(false);
+    spin_unlock_irqrestore(&led_lock, flags);
+
+    return HRTIMER_NORESTART;
+}
+
+// Act on one complete command line and acknowledge it (caller holds port->lock)
+static void uart_cmd_execute(struct uart_dev *port) {
+    struct uart_cmd_stats *stats = &port->cmd_stats;
+    char *cmd = port->cmd_buf;
+    unsigned int ms = UART_PULSE_MS;
+    bool on;
+    s64 ns;
+
+    cmd[port->cmd_len] = '\0';
+
+    spin_lock(&led_lock);
+    // A running pulse must not override the new state; if its callback is already
+    // waiting for led_lock it still switches the LED off, which is the pulse ending
+    hrtimer_try_to_cancel(&led_pulse_timer);
+
+    if (!strcmp(cmd, "ON")) {
+        uart_led_set(true);
+    } else if (!strcmp(cmd, "OFF")) {
+        uart_led_set(false);
+    } else if (!strcmp(cmd, "TOGGLE")) {
+        uart_led_set(!led_on);
+    } else if (!strncmp(cmd, "PULSE", 5) &&
+               (!cmd[5] || (cmd[5] == ' ' && !kstrtouint(cmd + 6, 10, &ms) && ms))) {
+        uart_led_set(true);
+        hrtimer_start(&led_pulse_timer, ms_to_ktime(ms), HRTIMER_MODE_REL);
+    } else {
+        spin_unlock(&led_lock);
+        stats->invalid++;
+        kfifo_in(&port->tx_fifo, "E\n", 2);
+        uart_tx_pump(port);
+        return;
+    }
+    on = led_on;
+    spin_unlock(&led_lock);
+
+    // Latency from the RX path picking up the bytes to the GPIO write
+    ns = ktime_to_ns(ktime_sub(ktime_get(), port->rx_stamp));
+    stats->latency_hist[min_t(unsigned int, uart_lat_bucket(ns), UART_CMD_HIST_BUCKETS - 1)]++;
+    stats->max_latency_ns = max_t(u64, stats->max_latency_ns, ns);
+    stats->commands++;
+
+    // Acknowledge with the resulting LED state (uart_tx_queue() would take port->lock again)
+    kfifo_in(&port->tx_fifo, on ? "1\n" : "0\n", 2);
+    uart_tx_pump(port);
+}
+
+// Streaming tokenizer: collect bytes up to a line terminator, then execute the line
+// (caller holds port->lock)
+static void uart_cmd_feed(struct uart_dev *port, const char *data, unsigned int len) {
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        char c = data[i];
+
+        if (c == '\n' || c == '\r' || c == '\0') { // "\r\n" just yields an empty second line
+            if (port->cmd_len && !port->cmd_overflow)
+                uart_cmd_execute(port);
+            port->cmd_len = 0;
+            port->cmd_overflow = false;
+        } else if (port->cmd_len < UART_CMD_MAX - 1) {
+            port->cmd_buf[port->cmd_len++] = c;
+        } else {
+            port->cmd_overflow = true; // Not a command, just long data
+        }
+    }
+}
+
+// Program the baud rate divisors and the frame format; fills in the achieved rate and its error
+static int uart_set_line(struct uart_dev *port, struct uart_line_config *cfg) {
+    unsigned long flags;
+    u64 divider;
+    u32 ibrd, fbrd, lcrh, cr;
+
+    if (!cfg->baud || cfg->data_bits < 5 || cfg->data_bits > 8 ||
+        cfg->stop_bits < 1 || cfg->stop_bits > 2 || cfg->parity > UART_PARITY_EVEN ||
+        cfg->flow > UART_FLOW_RTSCTS)
+        return -EINVAL;
+
+    // Baud rate divisor = UARTCLK / (16 * baud), kept in 1/64ths for the 6-bit fractional part
+    divider = DIV_ROUND_CLOSEST_ULL((u64)port->uartclk * 4, cfg->baud);
+    ibrd = divider >> 6;
+    fbrd = divider & 0x3F;
+    if (ibrd < 1 || ibrd > 0xFFFF || (ibrd == 0xFFFF && fbrd))
+        return -EINVAL; // Rate not reachable from this reference clock
+
+    cfg->actual_baud = DIV_ROUND_CLOSEST_ULL((u64)port->uartclk * 4, divider);
+    cfg->error_ppm = div_s64(((s64)cfg->actual_baud - cfg->baud) * 1000000, cfg->baud);
+    cfg->uartclk = port->uartclk;
+
+    lcrh = UART_LCRH_FEN | UART_LCRH_WLEN(cfg->data_bits);
+    if (cfg->stop_bits == 2)
+        lcrh |= UART_LCRH_STP2;
+    if (cfg->parity != UART_PARITY_NONE)
+        lcrh |= UART_LCRH_PEN;
+    if (cfg->parity == UART_PARITY_EVEN)
+        lcrh |= UART_LCRH_EPS;
+
+    spin_lock_irqsave(&port->lock, flags);
+    cr = readl(port->base + UART_CR) & ~(UART_CR_CTSEN | UART_CR_RTS);
+    if (cfg->flow == UART_FLOW_RTSCTS)
+        cr |= UART_CR_CTSEN;              // Transmit only while the peer asserts CTS
+    else
+        port->rx_throttled = false;       // RTS is always asserted without flow control
+    if (!port->rx_throttled)
+        cr |= UART_CR_RTS;                // Ready to receive
+    writel(0, port->base + UART_CR);      // Disable the UART while reprogramming it
+    writel(ibrd, port->base + UART_IBRD); // Set integer part of baud rate
+    writel(fbrd, port->base + UART_FBRD); // Set fractional part of baud rate
+    writel(lcrh, port->base + UART_LCRH); // Writing LCRH latches the new divisors
+    writel(cr, port->base + UART_CR);     // Restore the enable state with the new flow control bits
+    port->line_cfg = *cfg;
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    return 0;
+}
+
+// Interrupt handler for the RX, RX timeout and TX interrupts
+static irqreturn_t uart_irq_handler(int irq, void *dev_id) {
+    struct uart_dev *port = dev_id;
+    u32 status = readl(port->base + UART_MIS) & (UART_INT_RX | UART_INT_RT | UART_INT_TX | UART_INT_ERR);
+
+    if (!status)
+        return IRQ_NONE; // Not ours
+    UART_STAT_ADD(port, irqs, 1);
+
+    writel(status, port->base + UART_ICR); // Acknowledge before servicing so no edge is lost
+
+    if (status & (UART_INT_RX | UART_INT_RT)) {
+        spin_lock(&port->lock);
+        port->rx_stamp = ktime_get();     // Command and read latency are measured from here
+        if (port->dma_rx_running)
+            uart_dma_rx_flush(port);      // RX timeout: hand over the partly filled DMA buffer
+        else
+            uart_rx_drain(port);          // Empty the RX FIFO into the ring buffer
+        spin_unlock(&port->lock);
+        wake_up_interruptible(&port->rx_wait); // Wake up readers waiting for data
+    }
+
+    // Error interrupts are only unmasked in DMA mode, where the DR error bits are never seen
+    if (status & UART_INT_ERR) {
+        spin_lock(&port->lock);
+        uart_rx_count_errors(port, readl(port->base + UART_RSR));
+        writel(0, port->base + UART_RSR); // Writing the Error Clear Register clears the flags
+        spin_unlock(&port->lock);
+    }
+
+    if (status & UART_INT_TX) {
+        spin_lock(&port->lock);
+        uart_tx_pump(port);               // Refill the TX FIFO from the ring buffer
+        spin_unlock(&port->lock);
+        wake_up_interruptible(&port->tx_wait); // Wake up writers waiting for space or a drain
+    }
+
+    return IRQ_HANDLED;
+}
+
+// Data is waiting for the reader in whichever ring is receiving (whole records in timestamped mode)
+static bool uart_rx_ready(struct uart_dev *port) {
+    if (READ_ONCE(port->rx_tstamp) && !READ_ONCE(port->rx_ring_active))
+        return port->rx_rd.len || !kfifo_is_empty(&port->rx_marks);
+    return uart_rx_fill(port) != 0;
+}
+
+// Record how long the oldest byte handed out by read() waited since its RX interrupt
+static void uart_read_latency(struct uart_dev *port) {
+    s64 ns = ktime_to_ns(ktime_sub(ktime_get(), READ_ONCE(port->rx_oldest)));
+
+    // Bytes left behind are dated by the latest pickup, which slightly underestimates them
+    if (!kfifo_is_empty(&port->rx_fifo))
+        WRITE_ONCE(port->rx_oldest, READ_ONCE(port->rx_stamp));
+    if (READ_ONCE(collect_stats))
+        this_cpu_inc(port->stats->read_latency[uart_lat_bucket(ns)]);
+}
+
+// Wait until the RX ring buffer holds at least one byte (-EAGAIN for O_NONBLOCK callers)
+static int uart_rx_wait(struct uart_dev *port, struct file *file) {
+    int ret;
+
+    if (port->irq < 0 && !uart_rx_ready(port))
+        uart_rx_poll_drain(port); // No IRQ: pick up whatever the Receive FIFO already holds
+
+    if (uart_rx_ready(port))
+        return 0;
+    if (file->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+
+    if (port->irq >= 0) {
+        ret = wait_event_interruptible(port->rx_wait, uart_rx_ready(port));
+        if (!ret)
+            UART_STAT_ADD(port, rx_wakeups, 1);
+        return ret;
+    }
+
+    // No IRQ: wait until Receive FIFO is not empty, then drain it by hand
+    while (!uart_rx_ready(port)) {
+        while (readl(port->base + UART_FR) & UART_FR_RXFE) {
+            if (signal_pending(current))
+                return -ERESTARTSYS;
+            cpu_relax(); // Relax CPU until the data is available
+        }
+        uart_rx_poll_drain(port);
+    }
+
+    return 0;
+}
+
+// Wait until the TX ring buffer has room for more data (-EAGAIN for O_NONBLOCK callers)
+static int uart_tx_wait_space(struct uart_dev *port, struct file *file) {
+    unsigned long flags;
+    int ret;
+
+    if (!kfifo_is_full(&port->tx_fifo))
+        return 0;
+    if (file->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+
+    if (port->irq >= 0) {
+        ret = wait_event_interruptible(port->tx_wait, !kfifo_is_full(&port->tx_fifo));
+        if (!ret)
+            UART_STAT_ADD(port, tx_wakeups, 1);
+        return ret;
+    }
+
+    // No IRQ: feed the TX FIFO by hand until there is room again
+    while (kfifo_is_full(&port->tx_fifo)) {
+        if (signal_pending(current))
+            return -ERESTARTSYS;
+        spin_lock_irqsave(&port->lock, flags);
+        uart_tx_pump(port);
+        spin_unlock_irqrestore(&port->lock, flags);
+        cpu_relax();
+    }
+
+    return 0;
+}
+
+// Wait until every queued byte has been shifted out on the wire
+static int uart_tx_drain(struct uart_dev *port) {
+    unsigned long flags;
+    int ret;
+
+    if (port->irq >= 0) {
+        ret = wait_event_interruptible(port->tx_wait,
+                                       kfifo_is_empty(&port->tx_fifo) && !port->dma_tx_busy);
+        if (ret)
+            return ret;
+        UART_STAT_ADD(port, tx_wakeups, 1);
+    } else {
+        while (!kfifo_is_empty(&port->tx_fifo)) {
+            if (signal_pending(current))
+                return -ERESTARTSYS;
+            spin_lock_irqsave(&port->lock, flags);
+            uart_tx_pump(port);
+            spin_unlock_irqrestore(&port->lock, flags);
+            cpu_relax();
+        }
+    }
+
+    // The hardware FIFO holds at most 16 characters, so the last stretch is short
+    while (!(readl(port->base + UART_FR) & UART_FR_TXFE) || (readl(port->base + UART_FR) & UART_FR_BUSY)) {
+        if (signal_pending(current))
+            return -ERESTARTSYS;
+        usleep_range(50, 100);
+    }
+
+    return 0;
+}
 
-static void __iomem *uart_base; // Pointer to the base address of UART registers
 
 // Function to handle the opening of the UART device
 static int uart_open(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "UART device opened\n"); // Log message when the device is opened
+    struct uart_dev *port = container_of(inode->i_cdev, struct uart_dev, cdev);
+
+    file->private_data = port; // Every other file operation works on this port
+    dev_info(port->dev, "UART device opened\n"); // Log message when the device is opened
     return 0; // Successful open
 }
 
 // Function to handle writing data to the UART device
 static ssize_t uart_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
-    char c;
+    struct uart_dev *port = file->private_data;
+    size_t written = 0;
+    unsigned int n, queued;
+    ssize_t ret = 0;
 
-    // Write data to the UART
-    while (count--) {
-        if (copy_from_user(&c, buf++, 1))  // Copy a byte of data from user space
-            return -EFAULT;  // Return error if copy fails
+    if (file->f_flags & O_NONBLOCK) {
+        if (!mutex_trylock(&port->tx_lock))
+            return -EAGAIN; // Another writer is busy
+    } else if (mutex_lock_interruptible(&port->tx_lock)) {
+        return -ERESTARTSYS;
+    }
 
-        // Wait until Transmit FIFO is not full
-        while (readl(uart_base + UART_FR) & UART_FR_TXFF)
-            cpu_relax(); // Relax the CPU to prevent busy-waiting
+    // Copy the data into the TX ring buffer in bulk; the interrupt handler sends it
+    while (written < count) {
+        ret = uart_tx_wait_space(port, file); // Sleep until the ring buffer has room
+        if (ret)
+            break;
 
-        writel(c, uart_base + UART_DR); // Write the character to the data register
+        n = min_t(size_t, count - written, sizeof(port->tx_chunk));
+        if (copy_from_user(port->tx_chunk, buf + written, n)) {
+            ret = -EFAULT; // Return error if copy fails
+            break;
+        }
+
+        // Queue what fits; the rest is retried once the transmitter makes room
+        queued = uart_tx_queue(port, port->tx_chunk, n);
+        written += queued;
     }
 
-    return count; // Return the number of bytes written
+    // Polling mode has no interrupt to finish the job, so send everything before returning
+    if (port->irq < 0 && written)
+        uart_tx_drain(port);
+
+    mutex_unlock(&port->tx_lock);
+
+    if (written)
+        return written; // Return the number of bytes queued
+    return ret;
+}
+
+// Copy whole records (header, then bytes) to user space, splitting one that does not fit
+// (caller holds rx_lock)
+static ssize_t uart_read_records(struct uart_dev *port, char __user *buf, size_t count) {
+    struct uart_rx_record hdr;
+    size_t copied = 0;
+    unsigned int len, n;
+
+    while (count - copied > sizeof(hdr)) {
+        if (!port->rx_rd.len && !kfifo_get(&port->rx_marks, &port->rx_rd))
+            break; // No closed record left
+
+        len = min_t(size_t, port->rx_rd.len, count - copied - sizeof(hdr));
+        hdr.timestamp_ns = ktime_to_ns(port->rx_rd.stamp);
+        hdr.len = len;
+        hdr.flags = port->rx_rd.flags | (len < port->rx_rd.len ? UART_RX_REC_SPLIT : 0);
+        if (copy_to_user(buf + copied, &hdr, sizeof(hdr)))
+            return -EFAULT;
+        copied += sizeof(hdr);
+        port->rx_rd.len -= len;
+        port->rx_rd.flags &= ~UART_RX_REC_DROPPED; // Reported with the first part only
+
+        while (len) {
+            n = kfifo_out(&port->rx_fifo, port->rx_chunk, min_t(size_t, len, sizeof(port->rx_chunk)));
+            if (copy_to_user(buf + copied, port->rx_chunk, n))
+                return -EFAULT;
+            copied += n;
+            len -= n;
+        }
+    }
+
+    return copied;
 }
 
 // Function to handle reading data from the UART device
 static ssize_t uart_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
-    char c, data[4], i = 0;
+    struct uart_dev *port = file->private_data;
+    size_t copied = 0;
+    unsigned int n;
+    ssize_t ret;
 
-    // Wait until Receive FIFO is not empty
-    while (readl(uart_base + UART_FR) & UART_FR_RXFE)
-        cpu_relax(); // Relax CPU until the data is available
+    if (!count)
+        return 0;
 
-    c = readl(uart_base + UART_DR) & 0xFF; // Read a byte from the UART data register
-    data[i++] = c; // Store the byte in the data buffer
+    if (file->f_flags & O_NONBLOCK) {
+        if (!mutex_trylock(&port->rx_lock))
+            return -EAGAIN; // Another reader is busy
+    } else if (mutex_lock_interruptible(&port->rx_lock)) {
+        return -ERESTARTSYS;
+    }
 
-    if (copy_to_user(buf, &c, 1)) // Copy the byte to user space
-        return -EFAULT; // Return error if copy fails
+    // While the mmap ring is mapped, received data only goes there
+    if (READ_ONCE(port->rx_ring_active)) {
+        ret = -EBUSY;
+        goto out;
+    }
 
-    // Handle specific commands to control the LED based on received data
-    if (strcmp(data, "ON") == 0) {
-        gpio_set_value(LED, 1); // Turn LED ON (set GPIO pin high)
-        writel(1, uart_base + UART_DR); // Write "1" to UART data register to acknowledge
-    } else if (strcmp(data, "OFF") == 0) {
-        gpio_set_value(LED, 0); // Turn LED OFF (set GPIO pin low)
-        writel(0, uart_base + UART_DR); // Write "0" to UART data register to acknowledge
-    } else {
-        pr_err("Invalid command\n"); // Print error if the command is invalid
-        return -EINVAL; // Return invalid argument error
+    // Sleep (or poll, without an IRQ) until the ring buffer has data
+    ret = uart_rx_wait(port, file);
+    if (ret)
+        goto out;
+
+    if (port->rx_tstamp) {
+        ret = count > sizeof(struct uart_rx_record) ? uart_read_records(port, buf, count) : -EINVAL;
+        if (ret > 0)
+            uart_read_latency(port);
+        uart_rx_unthrottle(port);
+        goto out;
+    }
+
+    // Hand out as many buffered bytes as the caller asked for
+    while (copied < count) {
+        n = kfifo_out(&port->rx_fifo, port->rx_chunk,
+                      min_t(size_t, count - copied, sizeof(port->rx_chunk)));
+        if (!n)
+            break; // Ring buffer is empty
+
+        if (copy_to_user(buf + copied, port->rx_chunk, n)) { // Copy the bytes to user space
+            ret = -EFAULT; // Return error if copy fails
+            goto out;
+        }
+
+        copied += n;
+    }
+
+    if (copied)
+        uart_read_latency(port);
+    uart_rx_unthrottle(port); // Let the sender go again once the ring has drained
+
+    ret = copied; // Return the number of bytes read
+out:
+    mutex_unlock(&port->rx_lock);
+    return ret;
+}
+
+// Function to report readiness for poll(), select() and epoll()
+static __poll_t uart_poll(struct file *file, poll_table *wait) {
+    struct uart_dev *port = file->private_data;
+    __poll_t mask = 0;
+
+    poll_wait(file, &port->rx_wait, wait); // Woken by the RX interrupt when data arrives
+    poll_wait(file, &port->tx_wait, wait); // Woken by the TX interrupt when space frees up
+
+    // Without an IRQ nothing wakes the poller, so report the hardware FIFO state as it is now
+    uart_rx_unthrottle(port); // An mmap reader has no read() call to release RTS, so poll() does it
+
+    if (uart_rx_ready(port) || (port->irq < 0 && !(readl(port->base + UART_FR) & UART_FR_RXFE)))
+        mask |= EPOLLIN | EPOLLRDNORM;  // Data ready to be read
+    if (!kfifo_is_full(&port->tx_fifo))
+        mask |= EPOLLOUT | EPOLLWRNORM; // Room to queue more data
+
+    return mask;
+}
+
+// Function to count a new reference to the RX ring mapping (fork, split)
+static void uart_vma_open(struct vm_area_struct *vma) {
+    struct uart_dev *port = vma->vm_private_data;
+
+    mutex_lock(&port->rx_ring_lock);
+    port->rx_ring_maps++;
+    mutex_unlock(&port->rx_ring_lock);
+}
+
+// Function to stop filling the RX ring once the last mapping is gone
+static void uart_vma_close(struct vm_area_struct *vma) {
+    struct uart_dev *port = vma->vm_private_data;
+    unsigned long flags;
+
+    mutex_lock(&port->rx_ring_lock);
+    if (--port->rx_ring_maps == 0) {
+        spin_lock_irqsave(&port->lock, flags);
+        port->rx_ring_active = false; // Received data goes back to rx_fifo and read()
+        spin_unlock_irqrestore(&port->lock, flags);
+    }
+    mutex_unlock(&port->rx_ring_lock);
+}
+
+static const struct vm_operations_struct uart_vm_ops = {
+    .open = uart_vma_open,
+    .close = uart_vma_close,
+};
+
+// Function to map the zero-copy RX ring (header page + data pages) into user space
+static int uart_mmap(struct file *file, struct vm_area_struct *vma) {
+    struct uart_dev *port = file->private_data;
+    unsigned long flags;
+    int ret;
+
+    if (port->irq < 0)
+        return -ENODEV; // Only the interrupt handler fills the ring
+    if (vma->vm_pgoff || vma->vm_end - vma->vm_start != PAGE_SIZE + UART_MMAP_DATA_SIZE)
+        return -EINVAL; // Map the header page and the whole data area in one go
+
+    mutex_lock(&port->rx_ring_lock);
+    if (!port->rx_ring) {
+        // Kept until the port is removed, so the receive path never sees it disappear
+        port->rx_ring = vmalloc_user(PAGE_SIZE + UART_MMAP_DATA_SIZE);
+        if (!port->rx_ring) {
+            ret = -ENOMEM;
+            goto out;
+        }
+        port->rx_ring_data = (char *)port->rx_ring + PAGE_SIZE;
+    }
+
+    ret = remap_vmalloc_range(vma, port->rx_ring, 0);
+    if (ret)
+        goto out;
+    vma->vm_ops = &uart_vm_ops;
+    vma->vm_private_data = port;
+
+    if (port->rx_ring_maps++ == 0) {
+        spin_lock_irqsave(&port->lock, flags);
+        port->rx_ring->head = 0;
+        port->rx_ring->tail = 0;
+        port->rx_ring->size = UART_MMAP_DATA_SIZE;
+        port->rx_ring->data_offset = PAGE_SIZE;
+        port->rx_ring_active = true; // From now on received bytes land in the shared ring
+        spin_unlock_irqrestore(&port->lock, flags);
     }
+out:
+    mutex_unlock(&port->rx_ring_lock);
+    return ret;
+}
+
+// Function to flush the TX ring buffer onto the wire
+static int uart_fsync(struct file *file, loff_t start, loff_t end, int datasync) {
+    return uart_tx_drain(file->private_data);
+}
 
-    return 1; // Return the number of bytes read
+// Function to handle ioctl requests (tcdrain() is TCSBRK with a non-zero argument,
+// UART_IOC_SET_LINE / UART_IOC_GET_LINE change and report the line settings)
+static long uart_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    struct uart_dev *port = file->private_data;
+    struct uart_line_config cfg;
+    struct uart_rx_errors errors;
+    struct uart_cmd_stats stats;
+    struct uart_rx_tstamp_config ts;
+    unsigned long flags;
+    long ret;
+
+    switch (cmd) {
+    case TCSBRK:
+        if (!arg)
+            return -EINVAL; // Sending a break is not supported
+        return uart_tx_drain(port);
+    case UART_IOC_SET_LINE:
+        if (copy_from_user(&cfg, (void __user *)arg, sizeof(cfg)))
+            return -EFAULT;
+        if (mutex_lock_interruptible(&port->tx_lock))
+            return -ERESTARTSYS;
+        ret = uart_tx_drain(port); // Let queued data leave at the old rate first
+        if (!ret)
+            ret = uart_set_line(port, &cfg);
+        mutex_unlock(&port->tx_lock);
+        if (!ret && copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
+            ret = -EFAULT;
+        return ret;
+    case UART_IOC_GET_LINE:
+        spin_lock_irqsave(&port->lock, flags);
+        cfg = port->line_cfg;
+        spin_unlock_irqrestore(&port->lock, flags);
+        if (copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
+            return -EFAULT;
+        return 0;
+    case UART_IOC_GET_ERRORS:
+        spin_lock_irqsave(&port->lock, flags);
+        errors = port->rx_errors;
+        spin_unlock_irqrestore(&port->lock, flags);
+        if (copy_to_user((void __user *)arg, &errors, sizeof(errors)))
+            return -EFAULT;
+        return 0;
+    case UART_IOC_GET_CMD_STATS:
+        spin_lock_irqsave(&port->lock, flags);
+        stats = port->cmd_stats;
+        spin_unlock_irqrestore(&port->lock, flags);
+        if (copy_to_user((void __user *)arg, &stats, sizeof(stats)))
+            return -EFAULT;
+        return 0;
+    case UART_IOC_SET_RX_TSTAMP:
+        if (copy_from_user(&ts, (void __user *)arg, sizeof(ts)))
+            return -EFAULT;
+        if (ts.mode > UART_RX_TSTAMP_DELIM)
+            return -EINVAL;
+        if (mutex_lock_interruptible(&port->rx_lock))
+            return -ERESTARTSYS;
+        // Buffered bytes have no records (or the wrong ones), so start over
+        spin_lock_irqsave(&port->lock, flags);
+        kfifo_reset(&port->rx_fifo);
+        kfifo_reset(&port->rx_marks);
+        memset(&port->rx_open, 0, sizeof(port->rx_open));
+        memset(&port->rx_rd, 0, sizeof(port->rx_rd));
+        port->rx_delim = ts.delim;
+        WRITE_ONCE(port->rx_tstamp, ts.mode);
+        spin_unlock_irqrestore(&port->lock, flags);
+        mutex_unlock(&port->rx_lock);
+        uart_rx_unthrottle(port); // The ring is empty now
+        return 0;
+    case UART_IOC_GET_RX_TSTAMP:
+        memset(&ts, 0, sizeof(ts));
+        ts.mode = READ_ONCE(port->rx_tstamp);
+        ts.delim = READ_ONCE(port->rx_delim);
+        if (copy_to_user((void __user *)arg, &ts, sizeof(ts)))
+            return -EFAULT;
+        return 0;
+    default:
+        return -ENOTTY;
+    }
 }
 
 // Function to handle the closing of the UART device
 static int uart_close(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "UART device closed\n"); // Log message when the device is closed
+    struct uart_dev *port = file->private_data;
+
+    dev_info(port->dev, "UART device closed\n"); // Log message when the device is closed
     return 0; // Successful close
 }
 
+// debugfs uart/uartN/stats: sum the per-CPU counters (high-water marks take the maximum)
+static int uart_stats_show(struct seq_file *m, void *v) {
+    struct uart_dev *port = m->private;
+    struct uart_stats sum = { 0 };
+    struct uart_rx_errors err;
+    unsigned long flags;
+    int cpu, i;
+
+    for_each_possible_cpu(cpu) {
+        struct uart_stats *s = per_cpu_ptr(port->stats, cpu);
+
+        sum.rx_bytes += s->rx_bytes;
+        sum.tx_bytes += s->tx_bytes;
+        sum.irqs += s->irqs;
+        sum.rx_wakeups += s->rx_wakeups;
+        sum.tx_wakeups += s->tx_wakeups;
+        sum.rx_fifo_hwm = max(sum.rx_fifo_hwm, s->rx_fifo_hwm);
+        sum.rx_ring_hwm = max(sum.rx_ring_hwm, s->rx_ring_hwm);
+        sum.tx_ring_hwm = max(sum.tx_ring_hwm, s->tx_ring_hwm);
+        for (i = 0; i < UART_LAT_BUCKETS; i++)
+            sum.read_latency[i] += s->read_latency[i];
+    }
+
+    spin_lock_irqsave(&port->lock, flags);
+    err = port->rx_errors;
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    seq_printf(m, "rx_bytes: %llu\ntx_bytes: %llu\ninterrupts: %llu\n", sum.rx_bytes, sum.tx_bytes, sum.irqs);
+    seq_printf(m, "rx_wakeups: %llu\ntx_wakeups: %llu\n", sum.rx_wakeups, sum.tx_wakeups);
+    seq_printf(m, "rx_fifo_hwm: %llu\nrx_ring_hwm: %llu\ntx_ring_hwm: %llu\n",
+               sum.rx_fifo_hwm, sum.rx_ring_hwm, sum.tx_ring_hwm);
+    seq_printf(m, "overrun: %llu\nframing: %llu\nparity: %llu\nbreak: %llu\ndropped: %llu\nthrottled: %llu\n",
+               err.overrun, err.framing, err.parity, err.brk, err.dropped, err.throttled);
+    seq_puts(m, "read_latency_ns:\n");
+    for (i = 0; i < UART_LAT_BUCKETS; i++)
+        if (sum.read_latency[i])
+            seq_printf(m, "  >= %llu: %llu\n", 1ULL << i, sum.read_latency[i]);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(uart_stats);
+
 // File operations for the UART device
 static const struct file_operations uart_fops = {
     .owner = THIS_MODULE,
     .open = uart_open,  // Call uart_open when the device is opened
     .write = uart_write, // Call uart_write when writing to the device
     .read = uart_read,   // Call uart_read when reading from the device
+    .poll = uart_poll,   // Call uart_poll for poll(), select() and epoll()
+    .mmap = uart_mmap,   // Call uart_mmap to map the zero-copy RX ring
+    .fsync = uart_fsync, // Call uart_fsync to wait until written data is on the wire
+    .unlocked_ioctl = uart_ioctl, // Call uart_ioctl for tcdrain() and line configuration
     .release = uart_close, // Call uart_close when the device is closed
 };
 
-static int major;          // Variable to store the major number
-static struct class *uart_class; // Class for the UART device
+// Pick the minor number: the board's serialN alias if it has one and it is free, else the first free one
+static int uart_alloc_minor(struct device *dev) {
+    int minor = of_alias_get_id(dev->of_node, "serial");
 
-// Module initialization function
-static int __init uart_init(void) {
-    printk(KERN_INFO "Initializing UART driver\n");
+    if (minor >= 0 && minor < UART_MAX_PORTS)
+        minor = ida_alloc_range(&uart_minors, minor, minor, GFP_KERNEL);
+    if (minor < 0 || minor >= UART_MAX_PORTS)
+        minor = ida_alloc_max(&uart_minors, UART_MAX_PORTS - 1, GFP_KERNEL);
+    return minor;
+}
+
+// devm action undoing clk_prepare_enable() of the reference clock
+static void uart_clk_disable(void *clk) {
+    clk_disable_unprepare(clk);
+}
+
+// Bring up one PL011 instance found in the device tree
+static int uart_probe(struct amba_device *adev, const struct amba_id *id) {
+    struct device *dev = &adev->dev;
+    struct uart_dev *port;
+    struct device *node;
+    struct clk *clk;
+    dev_t devt;
+    int ret;
+
+    port = devm_kzalloc(dev, sizeof(*port), GFP_KERNEL);
+    if (!port)
+        return -ENOMEM;
+    port->stats = devm_alloc_percpu(dev, struct uart_stats);
+    if (!port->stats)
+        return -ENOMEM;
+
+    port->dev = dev;
+    INIT_KFIFO(port->rx_fifo);
+    INIT_KFIFO(port->rx_marks);
+    INIT_KFIFO(port->tx_fifo);
+    init_waitqueue_head(&port->rx_wait);
+    init_waitqueue_head(&port->tx_wait);
+    mutex_init(&port->rx_lock);
+    mutex_init(&port->rx_ring_lock);
+    mutex_init(&port->tx_lock);
+    spin_lock_init(&port->lock);
 
     // Map UART registers
-    uart_base = ioremap(UART0_BASE, UART_REG_SIZE);  // Map the base address of UART0 to virtual memory
-    if (!uart_base) {
-        printk(KERN_ERR "Failed to map UART registers\n");
-        return -ENOMEM; // Return memory allocation error if mapping fails
+    port->base = devm_ioremap_resource(dev, &adev->res);
+    if (IS_ERR(port->base)) {
+        dev_err(dev, "Failed to map UART registers\n");
+        return PTR_ERR(port->base);
     }
+    port->phys_base = adev->res.start;
+
+    // The divisors depend on this port's reference clock
+    clk = devm_clk_get_optional(dev, "uartclk");
+    if (IS_ERR(clk))
+        return PTR_ERR(clk);
+    ret = clk_prepare_enable(clk);
+    if (ret)
+        return ret;
+    ret = devm_add_action_or_reset(dev, uart_clk_disable, clk); // Stopped again when the port goes away
+    if (ret)
+        return ret;
+    port->uartclk = clk_get_rate(clk) ?: uartclk;
+
+    port->minor = uart_alloc_minor(dev);
+    if (port->minor < 0)
+        return port->minor;
+    devt = MKDEV(MAJOR(uart_devt), port->minor);
 
     // Disable UART
-    writel(0, uart_base + UART_CR); // Disable UART by clearing control register
+    writel(0, port->base + UART_CR); // Disable UART by clearing control register
+
+    // Configure UART (baud rate from the module parameter, 8N1 format)
+    port->line_cfg.baud = baud;
+    port->line_cfg.data_bits = 8;
+    port->line_cfg.parity = UART_PARITY_NONE;
+    port->line_cfg.stop_bits = 1;
+    port->line_cfg.flow = crtscts ? UART_FLOW_RTSCTS : UART_FLOW_NONE;
+    ret = uart_set_line(port, &port->line_cfg);
+    if (ret) {
+        dev_err(dev, "Cannot derive %u baud from a %u Hz UART clock\n", baud, port->uartclk);
+        goto r_minor;
+    }
+    writel(UART_IFLS_RX4_8 | UART_IFLS_TX4_8, port->base + UART_IFLS); // Half-full FIFO interrupt levels
+    writel(0, port->base + UART_IMSC);    // Keep all interrupts masked until the handler is in place
+    writel(0x7FF, port->base + UART_ICR); // Clear any stale interrupts
+    writel(readl(port->base + UART_CR) | (1 << 9) | (1 << 8) | 1, port->base + UART_CR); // Enable UART, keeping RTS/CTS
+
+    // Hook up the UART interrupt, or stay on the polling path if asked to
+    port->irq = !polling && adev->irq[0] > 0 ? adev->irq[0] : -1;
+    if (port->irq >= 0) {
+        ret = devm_request_irq(dev, port->irq, uart_irq_handler, IRQF_SHARED, dev_name(dev), port);
+        if (ret) {
+            dev_err(dev, "Failed to request UART IRQ %d\n", port->irq);
+            goto r_irq;
+        }
+        port->imsc = UART_INT_RX | UART_INT_RT; // Unmask RX and RX timeout, TX only while data is queued
+        writel(port->imsc, port->base + UART_IMSC);
 
-    // Configure UART (115200 baud rate, 8N1 format)
-    writel(1, uart_base + UART_IBRD);    // Set integer part of baud rate
-    writel(40, uart_base + UART_FBRD);   // Set fractional part of baud rate
-    writel((3 << 5) | (1 << 4), uart_base + UART_LCRH); // Set line control for 8 data bits, no parity, 1 stop bit
-    writel((1 << 9) | (1 << 8) | 1, uart_base + UART_CR); // Enable UART
+        // Optionally move bulk transfers to DMA; without channels the IRQ path stays in charge
+        if (dma && uart_dma_init(port))
+            dev_info(dev, "No UART DMA channels available, using the IRQ path\n");
+    }
+
+    // Register the character device and create /dev/uartN
+    cdev_init(&port->cdev, &uart_fops);
+    port->cdev.owner = THIS_MODULE;
+    ret = cdev_add(&port->cdev, devt, 1);
+    if (ret) {
+        dev_err(dev, "Failed to register UART device\n");
+        goto r_irq;
+    }
+
+    node = device_create(uart_class, dev, devt, port, "uart%d", port->minor);
+    if (IS_ERR(node)) {
+        ret = PTR_ERR(node);
+        goto r_cdev;
+    }
+
+    // Statistics are best effort, a missing debugfs does not fail the port
+    port->debugfs = debugfs_create_dir(dev_name(node), uart_debugfs);
+    debugfs_create_file("stats", 0444, port->debugfs, port, &uart_stats_fops);
+
+    amba_set_drvdata(adev, port);
+    dev_info(dev, "uart%d at %u baud (error %d ppm, UARTCLK %u Hz, %s)\n", port->minor,
+             port->line_cfg.actual_baud, port->line_cfg.error_ppm, port->uartclk,
+             port->irq < 0 ? "polling" : port->dma_rx_chan ? "DMA" : "IRQ");
+
+    return 0;
+
+r_cdev:
+    cdev_del(&port->cdev);
+r_irq:
+    writel(0, port->base + UART_IMSC); // Mask all UART interrupts; devm frees the IRQ
+    uart_dma_release(port);            // Stop and release the DMA channels, if any
+    writel(0, port->base + UART_CR);   // Disable the UART again
+r_minor:
+    ida_free(&uart_minors, port->minor);
+    return ret;
+}
+
+// Tear down one port (module unload only, see suppress_bind_attrs)
+static void uart_remove(struct amba_device *adev) {
+    struct uart_dev *port = amba_get_drvdata(adev);
+
+    debugfs_remove_recursive(port->debugfs);    // Remove the statistics before the port goes away
+    device_destroy(uart_class, port->cdev.dev); // Destroy the device file
+    cdev_del(&port->cdev);                      // Unregister the character device
+    writel(0, port->base + UART_IMSC);          // Mask all UART interrupts; devm frees the IRQ
+    uart_dma_release(port);                     // Stop and release the DMA channels, if any
+    writel(0, port->base + UART_CR);            // Disable the UART before devm stops its clock
+    vfree(port->rx_ring);                       // Release the mmap RX ring, if it was ever mapped
+    dev_info(port->dev, "RX errors: %llu overrun, %llu framing, %llu parity, %llu break, %llu dropped\n",
+             port->rx_errors.overrun, port->rx_errors.framing, port->rx_errors.parity,
+             port->rx_errors.brk, port->rx_errors.dropped);
+    dev_info(port->dev, "commands: %llu executed, %llu invalid, max latency %llu ns\n",
+             port->cmd_stats.commands, port->cmd_stats.invalid, port->cmd_stats.max_latency_ns);
+    ida_free(&uart_minors, port->minor);
+}
+
+// Every PL011, whatever the board
+static const struct amba_id uart_ids[] = {
+    { .id = 0x00041011, .mask = 0x000fffff },
+    { 0, 0 },
+};
+
+static struct amba_driver uart_driver = {
+    .drv = {
+        .name = "uart_rx_data",
+        .owner = THIS_MODULE,
+        // Without bind/unbind in sysfs a port only goes away on rmmod, which open files prevent
+        .suppress_bind_attrs = true,
+    },
+    .id_table = uart_ids,
+    .probe = uart_probe,
+    .remove = uart_remove,
+};
+
+// Module initialization function
+static int __init uart_init(void) {
+    int ret;
+
+    printk(KERN_INFO "Initializing UART driver\n");
 
     // Request and configure the GPIO pin for the LED
-    int ret = gpio_request(LED, "GPIO_LED"); // Request the GPIO pin for the LED
+    ret = gpio_request(LED, "GPIO_LED"); // Request the GPIO pin for the LED
     if (ret) {
         pr_err("Unable to request GPIO\n");
         return ret; // Return error if GPIO request fails
     }
-    
+
     // Set GPIO pin direction to output (initial value is LOW)
     ret = gpio_direction_output(LED, 0); // Set GPIO pin direction as output and initialize to 0 (OFF)
     if (ret) {
         pr_err("Failed to set GPIO direction for pin %d\n", LED);
-        return ret; // Return error if setting GPIO direction fails
+        goto r_gpio; // Return error if setting GPIO direction fails
     }
+    hrtimer_init(&led_pulse_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    led_pulse_timer.function = uart_led_pulse_end;
 
-    // Register the UART device
-    major = register_chrdev(0, "uart", &uart_fops); // Register the character device
-    if (major < 0) {
-        printk(KERN_ERR "Failed to register UART device\n");
-        iounmap(uart_base); // Unmap UART registers if registration fails
-        return major; // Return error code if registration fails
+    // Reserve the device numbers for all ports
+    ret = alloc_chrdev_region(&uart_devt, 0, UART_MAX_PORTS, "uart");
+    if (ret) {
+        printk(KERN_ERR "Failed to register UART device numbers\n");
+        goto r_gpio;
     }
 
-    // Create a device file for the UART device
-    uart_class = class_create(THIS_MODULE, "uart");  // Create a class for the UART device
+    // Create a class for the UART devices
+    uart_class = class_create(THIS_MODULE, "uart");
     if (IS_ERR(uart_class)) {
-        unregister_chrdev(major, "uart"); // Unregister device if class creation fails
-        iounmap(uart_base); // Unmap UART registers
-        return PTR_ERR(uart_class); // Return error if class creation fails
+        ret = PTR_ERR(uart_class); // Return error if class creation fails
+        goto r_chrdev;
     }
 
-    device_create(uart_class, NULL, MKDEV(major, 0), NULL, "uart"); // Create the device file
-    printk(KERN_INFO "UART driver initialized successfully\n");
+    uart_debugfs = debugfs_create_dir("uart", NULL); // Parent of the per-port statistics
+
+    // Probe every PL011 that is not bound to another driver
+    ret = amba_driver_register(&uart_driver);
+    if (ret)
+        goto r_debugfs;
 
+    printk(KERN_INFO "UART driver initialized successfully\n");
     return 0; // Return 0 if initialization is successful
+
+r_debugfs:
+    debugfs_remove_recursive(uart_debugfs);
+    class_destroy(uart_class);
+r_chrdev:
+    unregister_chrdev_region(uart_devt, UART_MAX_PORTS);
+r_gpio:
+    gpio_free(LED); // Release the LED GPIO
+    return ret;
 }
 
 // Module cleanup function
@@ -179,10 +1619,12 @@ static void __exit uart_exit(void) {
     printk(KERN_INFO "Exiting UART driver\n");
 
     // Clean up resources
-    device_destroy(uart_class, MKDEV(major, 0)); // Destroy the device file
+    amba_driver_unregister(&uart_driver); // Removes every port
+    debugfs_remove_recursive(uart_debugfs); // Remove the statistics directory
     class_destroy(uart_class); // Destroy the class
-    unregister_chrdev(major, "uart"); // Unregister the character device
-    iounmap(uart_base); // Unmap the UART registers
+    unregister_chrdev_region(uart_devt, UART_MAX_PORTS); // Release the device numbers
+    hrtimer_cancel(&led_pulse_timer); // No more commands can arrive, stop a running pulse
+    gpio_free(LED); // Release the LED GPIO
 }
 
 module_init(uart_init);   // Register the module initialization function
@@ -1,11 +1,26 @@
 /*
  * Pseudo Code:
- * 1. Define UART register base address and memory size.
- * 2. Define UART register offsets and flags.
- * 3. Declare a pointer for memory-mapped I/O of UART registers.
- * 4. Define file operations: open, write, read, and close.
- * 5. Define module initialization and cleanup functions.
- * 6. Register and configure UART device, mapping memory and handling device creation and cleanup.
+ * 1. Define UART register offsets and flags.
+ * 2. Define a per-port state structure: register mapping, IRQ, TX ring buffer, locks and the
+ *    character device. Every port bound to this driver gets its own /dev/uart_txN.
+ * 3. Define file operations: open, write, poll, fsync, and close.
+ *    - write copies user data in bulk into the TX ring buffer and returns once it is queued.
+ *    - fsync (and tcdrain(), via TCSBRK) waits until the queued data has left the transmitter.
+ *    - poll reports EPOLLOUT while the TX ring has room; O_NONBLOCK writes return -EAGAIN
+ *      instead of sleeping.
+ *    - Receiving is left to uart_rx_data.c; this device is transmit-only.
+ * 4. Define the interrupt handler: on the TX interrupt (TX FIFO half empty) refill the TX FIFO
+ *    from the TX ring buffer and wake up writers waiting for space or a drain.
+ *    Without an IRQ (polling=1) write pumps the TX FIFO itself and returns once the data is sent.
+ * 5. Define probe and remove for each port, and module initialization and cleanup that reserve
+ *    the device numbers and register the driver.
+ *
+ * The full receive/transmit driver (RX ring, DMA, mmap, line configuration, statistics) is
+ * uart_rx_data.c, which binds PL011s by their AMBA peripheral ID. A port meant for this driver
+ * is described with its own compatible instead of "arm,pl011", "arm,primecell", so the two
+ * drivers (and the stock amba-pl011) never compete for it:
+ *    serial@... { compatible = "team17,pl011-tx"; reg = <...>; interrupts = <...>;
+ *                 clocks = <...>; clock-names = "uartclk"; };
  */
 
 // Include necessary Linux kernel headers
@@ -16,10 +31,24 @@
 #include <linux/fs.h>
 #include <linux/uaccess.h>
 #include <linux/device.h>
-
-// Define base address and size for UART0 (for Raspberry Pi 3/4, adjust for RPi1/2)
-#define UART0_BASE   0x3F201000 // Base address for UART0
-#define UART_REG_SIZE 0x1000    // Memory size to map for UART registers
+#include <linux/cdev.h>
+#include <linux/platform_device.h>
+#include <linux/of.h>
+#include <linux/clk.h>
+#include <linux/idr.h>
+#include <linux/interrupt.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/delay.h>
+#include <linux/poll.h>
+#include <linux/math64.h>
+#include <linux/sched/signal.h>
+#include <asm/ioctls.h>
+
+// Minor numbers reserved for PL011 instances
+#define UART_MAX_PORTS 8
 
 // Define UART register offsets (based on the datasheet for UART)
 #define UART_DR      0x00 // Data Register (holds data for transmission/reception)
@@ -28,133 +57,446 @@
 #define UART_FBRD    0x28 // Fractional Baud Rate Divisor
 #define UART_LCRH    0x2C // Line Control Register (for configuring UART line settings)
 #define UART_CR      0x30 // Control Register (enables/disables UART)
+#define UART_IFLS    0x34 // Interrupt FIFO Level Select Register
 #define UART_IMSC    0x38 // Interrupt Mask Set/Clear Register
+#define UART_MIS     0x40 // Masked Interrupt Status Register
+#define UART_ICR     0x44 // Interrupt Clear Register
 
 // UART Flags (used for status checking)
+#define UART_FR_TXFE 0x80 // Transmit FIFO Empty
 #define UART_FR_TXFF 0x20 // Transmit FIFO Full (if set, UART is busy transmitting)
-#define UART_FR_RXFE 0x10 // Receive FIFO Empty (if set, no data is available to read)
+#define UART_FR_BUSY 0x08 // UART Busy (set until the last stop bit has left the shift register)
+
+#define UART_INT_TX  (1 << 5) // Transmit interrupt (TX FIFO dropped to its trigger level)
+
+#define UART_IFLS_TX4_8 (2 << 0) // Raise the TX interrupt when the TX FIFO is half empty
+
+#define UART_TX_BUF_SIZE 4096 // Size of the TX ring buffer (must be a power of two)
+#define UART_WRITE_CHUNK 256  // Bytes moved into the TX ring buffer per copy_from_user()
+
+// Module parameters applied to every port
+static bool polling; // Ignore the IRQ and pump the TX FIFO from write()
+module_param(polling, bool, 0444);
+MODULE_PARM_DESC(polling, "Poll the Flag Register instead of using the PL011 IRQ");
+
+static unsigned int uartclk = 48000000; // Used when the device tree gives no "uartclk" clock
+module_param(uartclk, uint, 0444);
+MODULE_PARM_DESC(uartclk, "Fallback UART reference clock in Hz (Raspberry Pi firmware default 48 MHz)");
+
+static unsigned int baud = 115200; // Line rate programmed when a port is probed
+module_param(baud, uint, 0444);
+MODULE_PARM_DESC(baud, "Baud rate (8N1)");
+
+// Everything one PL011 instance needs
+struct uart_dev {
+    struct device *dev;                      // The port the device tree describes
+    void __iomem *base;                      // I/O memory base pointer for UART registers
+    int irq;                                 // Linux IRQ number, -1 in polling mode
+    int minor;                               // Minor number of /dev/uart_txN
+    struct cdev cdev;                        // Character device of this port
+
+    // TX side: filled by uart_write(), drained by the interrupt handler
+    DECLARE_KFIFO(tx_fifo, char, UART_TX_BUF_SIZE); // Bytes queued but not yet in the TX FIFO
+    wait_queue_head_t tx_wait;               // Writers wait here for space or for a drain
+    struct mutex tx_lock;                    // Serialises writers (and tx_chunk)
+    char tx_chunk[UART_WRITE_CHUNK];         // Bounce buffer, protected by tx_lock
+    spinlock_t lock;                         // Protects tx_fifo and imsc against the IRQ
+    u32 imsc;                                // Shadow of the interrupt mask register
+};
+
+// Device numbers of all ports
+static dev_t uart_devt;
+
+// Class structure for creating the devices
+static struct class *uart_class;
+
+// Minor numbers in use
+static DEFINE_IDA(uart_minors);
+
+// Refill the TX FIFO from the ring buffer; the TX interrupt stays enabled while data is pending
+// (caller holds port->lock)
+static void uart_tx_pump(struct uart_dev *port) {
+    char c;
+
+    while (!(readl(port->base + UART_FR) & UART_FR_TXFF) && kfifo_get(&port->tx_fifo, &c))
+        writel(c, port->base + UART_DR); // Write the character to the UART Data Register
+
+    if (port->irq < 0)
+        return; // Polling mode: the writer keeps pumping itself
+
+    if (kfifo_is_empty(&port->tx_fifo))
+        port->imsc &= ~UART_INT_TX; // Nothing left to send, stop TX interrupts
+    else
+        port->imsc |= UART_INT_TX;  // Come back when the TX FIFO is half empty
+    writel(port->imsc, port->base + UART_IMSC);
+}
+
+// Queue kernel data for transmission, returns the number of bytes accepted
+static unsigned int uart_tx_queue(struct uart_dev *port, const char *data, unsigned int len) {
+    unsigned long flags;
+    unsigned int n;
+
+    spin_lock_irqsave(&port->lock, flags);
+    n = kfifo_in(&port->tx_fifo, data, len);
+    uart_tx_pump(port); // Start the transmitter right away
+    spin_unlock_irqrestore(&port->lock, flags);
+
+    return n;
+}
+
+// Interrupt handler for the TX interrupt
+static irqreturn_t uart_irq_handler(int irq, void *dev_id) {
+    struct uart_dev *port = dev_id;
+    u32 status = readl(port->base + UART_MIS) & UART_INT_TX;
+
+    if (!status)
+        return IRQ_NONE; // Not ours
+
+    writel(status, port->base + UART_ICR); // Acknowledge before servicing so no edge is lost
 
-// Pointer to map UART register space
-static void __iomem *uart_base; // I/O memory base pointer for UART registers
+    spin_lock(&port->lock);
+    uart_tx_pump(port);                    // Refill the TX FIFO from the ring buffer
+    spin_unlock(&port->lock);
+    wake_up_interruptible(&port->tx_wait); // Wake up writers waiting for space or a drain
+
+    return IRQ_HANDLED;
+}
+
+// No IRQ: feed the TX FIFO by hand until the ring has room, or until it is empty with drain set
+static int uart_tx_poll(struct uart_dev *port, bool drain) {
+    unsigned long flags;
+
+    while (drain ? !kfifo_is_empty(&port->tx_fifo) : kfifo_is_full(&port->tx_fifo)) {
+        if (signal_pending(current))
+            return -ERESTARTSYS;
+        spin_lock_irqsave(&port->lock, flags);
+        uart_tx_pump(port);
+        spin_unlock_irqrestore(&port->lock, flags);
+        cpu_relax();
+    }
+
+    return 0;
+}
+
+// Wait until the TX ring buffer has room for more data (-EAGAIN for O_NONBLOCK callers)
+static int uart_tx_wait_space(struct uart_dev *port, struct file *file) {
+    if (!kfifo_is_full(&port->tx_fifo))
+        return 0;
+    if (file->f_flags & O_NONBLOCK)
+        return -EAGAIN;
+
+    if (port->irq >= 0)
+        return wait_event_interruptible(port->tx_wait, !kfifo_is_full(&port->tx_fifo));
+    return uart_tx_poll(port, false);
+}
+
+// Wait until every queued byte has been shifted out on the wire
+static int uart_tx_drain(struct uart_dev *port) {
+    int ret;
+
+    if (port->irq >= 0)
+        ret = wait_event_interruptible(port->tx_wait, kfifo_is_empty(&port->tx_fifo));
+    else
+        ret = uart_tx_poll(port, true);
+    if (ret)
+        return ret;
+
+    // The hardware FIFO holds at most 16 characters, so the last stretch is short
+    while (!(readl(port->base + UART_FR) & UART_FR_TXFE) || (readl(port->base + UART_FR) & UART_FR_BUSY)) {
+        if (signal_pending(current))
+            return -ERESTARTSYS;
+        usleep_range(50, 100);
+    }
+
+    return 0;
+}
 
 // File operation for opening the UART device
 static int uart_open(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "UART device opened\n"); // Log a message when device is opened
+    struct uart_dev *port = container_of(inode->i_cdev, struct uart_dev, cdev);
+
+    file->private_data = port; // Every other file operation works on this port
+    dev_info(port->dev, "UART device opened\n"); // Log a message when device is opened
     return 0; // Return 0 for success
 }
 
 // File operation for writing to the UART device
 static ssize_t uart_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
-    char c; // Temporary variable to hold a character to be transmitted
+    struct uart_dev *port = file->private_data;
+    size_t written = 0;
+    unsigned int n;
+    ssize_t ret = 0;
+
+    if (file->f_flags & O_NONBLOCK) {
+        if (!mutex_trylock(&port->tx_lock))
+            return -EAGAIN; // Another writer is busy
+    } else if (mutex_lock_interruptible(&port->tx_lock)) {
+        return -ERESTARTSYS;
+    }
 
-    // Loop through the data to write
-    while (count--) {
-        // Copy one byte of data from user space to kernel space
-        if (copy_from_user(&c, buf++, 1))
-            return -EFAULT; // Return error if copying fails
+    // Copy the data into the TX ring buffer in bulk; the interrupt handler sends it
+    while (written < count) {
+        ret = uart_tx_wait_space(port, file); // Sleep until the ring buffer has room
+        if (ret)
+            break;
 
-        // Wait until the Transmit FIFO is not full
-        while (readl(uart_base + UART_FR) & UART_FR_TXFF)
-            cpu_relax(); // Relax CPU to allow other tasks to run while waiting
+        n = min_t(size_t, count - written, sizeof(port->tx_chunk));
+        if (copy_from_user(port->tx_chunk, buf + written, n)) {
+            ret = -EFAULT; // Return error if copying fails
+            break;
+        }
 
-        // Write the character to the UART Data Register
-        writel(c, uart_base + UART_DR);
+        // Queue what fits; the rest is retried once the transmitter makes room
+        written += uart_tx_queue(port, port->tx_chunk, n);
     }
 
-    return count; // Return the number of bytes written
+    // Polling mode has no interrupt to finish the job, so send everything before returning
+    if (port->irq < 0 && written)
+        uart_tx_drain(port);
+
+    mutex_unlock(&port->tx_lock);
+
+    if (written)
+        return written; // Return the number of bytes queued
+    return ret;
 }
 
-// File operation for reading from the UART device
-static ssize_t uart_read(struct file *file, char __user *buf, size_t count, loff_t *ppos) {
-    char c; // Temporary variable to store received data
+// File operation for poll(), select() and epoll() readiness
+static __poll_t uart_poll(struct file *file, poll_table *wait) {
+    struct uart_dev *port = file->private_data;
 
-    // Wait until the Receive FIFO has data
-    while (readl(uart_base + UART_FR) & UART_FR_RXFE)
-        cpu_relax(); // Relax CPU to allow other tasks while waiting
+    poll_wait(file, &port->tx_wait, wait); // Woken by the TX interrupt when space frees up
 
-    // Read one byte of data from UART Data Register
-    c = readl(uart_base + UART_DR) & 0xFF;
+    // Without an IRQ write() empties the ring before it returns, so it is never left full
+    if (!kfifo_is_full(&port->tx_fifo))
+        return EPOLLOUT | EPOLLWRNORM; // Room to queue more data
+    return 0;
+}
 
-    // Copy the received byte to user space
-    if (copy_to_user(buf, &c, 1))
-        return -EFAULT; // Return error if copying fails
+// File operation for flushing the TX ring buffer onto the wire
+static int uart_fsync(struct file *file, loff_t start, loff_t end, int datasync) {
+    return uart_tx_drain(file->private_data);
+}
 
-    return 1; // Return 1 byte read
+// File operation for ioctl requests (tcdrain() is TCSBRK with a non-zero argument)
+static long uart_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    switch (cmd) {
+    case TCSBRK:
+        if (!arg)
+            return -EINVAL; // Sending a break is not supported
+        return uart_tx_drain(file->private_data);
+    default:
+        return -ENOTTY;
+    }
 }
 
 // File operation for closing the UART device
 static int uart_close(struct inode *inode, struct file *file) {
-    printk(KERN_INFO "UART device closed\n"); // Log a message when device is closed
+    struct uart_dev *port = file->private_data;
+
+    dev_info(port->dev, "UART device closed\n"); // Log a message when device is closed
     return 0; // Return 0 for success
 }
 
-// File operations structure (open, write, read, close)
+// File operations structure (open, write, poll, fsync, ioctl, close)
 static const struct file_operations uart_fops = {
     .owner = THIS_MODULE,        // Set module as the owner of the operations
     .open = uart_open,           // Assign the open function
     .write = uart_write,         // Assign the write function
-    .read = uart_read,           // Assign the read function
+    .poll = uart_poll,           // Assign the poll function
+    .fsync = uart_fsync,         // Assign the fsync function
+    .unlocked_ioctl = uart_ioctl, // Assign the ioctl function
     .release = uart_close,       // Assign the close function
 };
 
-// Major number for the character device
-static int major;
-
-// Class structure for creating the device
-static struct class *uart_class;
+// devm action undoing clk_prepare_enable() of the reference clock
+static void uart_clk_disable(void *clk) {
+    clk_disable_unprepare(clk);
+}
 
-// Module initialization function
-static int __init uart_init(void) {
-    printk(KERN_INFO "Initializing UART driver\n");
+// Probe function, called for every "team17,pl011-tx" node in the device tree
+static int uart_probe(struct platform_device *pdev) {
+    struct device *dev = &pdev->dev;
+    struct uart_dev *port;
+    struct device *node;
+    struct clk *clk;
+    unsigned int rate;
+    u64 divider;
+    dev_t devt;
+    int ret;
+
+    port = devm_kzalloc(dev, sizeof(*port), GFP_KERNEL);
+    if (!port)
+        return -ENOMEM;
+
+    port->dev = dev;
+    INIT_KFIFO(port->tx_fifo);
+    init_waitqueue_head(&port->tx_wait);
+    mutex_init(&port->tx_lock);
+    spin_lock_init(&port->lock);
 
     // Map UART registers into kernel virtual address space
-    uart_base = ioremap(UART0_BASE, UART_REG_SIZE);
-    if (!uart_base) {
-        printk(KERN_ERR "Failed to map UART registers\n");
-        return -ENOMEM; // Return error if mapping fails
+    port->base = devm_platform_ioremap_resource(pdev, 0);
+    if (IS_ERR(port->base)) {
+        dev_err(dev, "Failed to map UART registers\n");
+        return PTR_ERR(port->base);
     }
 
+    // The divisors depend on this port's reference clock
+    clk = devm_clk_get_optional(dev, "uartclk");
+    if (IS_ERR(clk))
+        return PTR_ERR(clk);
+    ret = clk_prepare_enable(clk);
+    if (ret)
+        return ret;
+    ret = devm_add_action_or_reset(dev, uart_clk_disable, clk); // Stopped again when the port goes away
+    if (ret)
+        return ret;
+    rate = clk_get_rate(clk) ?: uartclk;
+
+    // Baud rate divisor = UARTCLK / (16 * baud), kept in 1/64ths for the 6-bit fractional part
+    divider = baud ? DIV_ROUND_CLOSEST_ULL((u64)rate * 4, baud) : 0;
+    if (divider < 1 << 6 || divider > 0xFFFF << 6) {
+        dev_err(dev, "Cannot derive %u baud from a %u Hz UART clock\n", baud, rate);
+        return -EINVAL;
+    }
+
+    port->minor = ida_alloc_max(&uart_minors, UART_MAX_PORTS - 1, GFP_KERNEL);
+    if (port->minor < 0)
+        return port->minor;
+    devt = MKDEV(MAJOR(uart_devt), port->minor);
+
     // Disable UART by clearing the UART Control Register
-    writel(0, uart_base + UART_CR);
-
-    // Configure UART (Baud Rate: 115200, 8N1 format)
-    writel(1, uart_base + UART_IBRD); // Set Integer Baud Rate Divisor (1 for 115200)
-    writel(40, uart_base + UART_FBRD); // Set Fractional Baud Rate Divisor (40 for 115200)
-    writel((3 << 5) | (1 << 4), uart_base + UART_LCRH); // Set Line Control (8-bit, no parity, 1 stop bit)
-    writel((1 << 9) | (1 << 8) | 1, uart_base + UART_CR); // Enable UART (TX/RX, UART Enable)
-
-    // Register the character device with a dynamically assigned major number
-    major = register_chrdev(0, "uart", &uart_fops);
-    if (major < 0) {
-        printk(KERN_ERR "Failed to register UART device\n");
-        iounmap(uart_base); // Unmap the UART registers on failure
-        return major; // Return the error code from registering the device
+    writel(0, port->base + UART_CR);
+
+    // Configure UART (baud rate from the module parameter, 8N1 format)
+    writel(divider >> 6, port->base + UART_IBRD);   // Set Integer Baud Rate Divisor
+    writel(divider & 0x3F, port->base + UART_FBRD); // Set Fractional Baud Rate Divisor
+    writel((3 << 5) | (1 << 4), port->base + UART_LCRH); // Set Line Control (8-bit, no parity, 1 stop bit)
+    writel(UART_IFLS_TX4_8, port->base + UART_IFLS); // TX interrupt at half-empty FIFO
+    writel(0, port->base + UART_IMSC);    // TX is unmasked only while data is queued
+    writel(0x7FF, port->base + UART_ICR); // Clear any stale interrupts
+    writel((1 << 9) | (1 << 8) | 1, port->base + UART_CR); // Enable UART (TX/RX, UART Enable)
+
+    // Hook up the UART interrupt, or stay on the polling path if asked to
+    port->irq = polling ? -1 : platform_get_irq_optional(pdev, 0);
+    if (port->irq == -EPROBE_DEFER) {
+        ret = port->irq;
+        goto r_irq;
+    }
+    if (port->irq < 0)
+        port->irq = -1; // No interrupt in the node: write() pumps the FIFO itself
+    if (port->irq >= 0) {
+        ret = devm_request_irq(dev, port->irq, uart_irq_handler, IRQF_SHARED, dev_name(dev), port);
+        if (ret) {
+            dev_err(dev, "Failed to request UART IRQ %d\n", port->irq);
+            goto r_irq;
+        }
+    }
+
+    // Register the character device and create /dev/uart_txN
+    cdev_init(&port->cdev, &uart_fops);
+    port->cdev.owner = THIS_MODULE;
+    ret = cdev_add(&port->cdev, devt, 1);
+    if (ret) {
+        dev_err(dev, "Failed to register UART device\n");
+        goto r_irq;
+    }
+
+    node = device_create(uart_class, dev, devt, port, "uart_tx%d", port->minor);
+    if (IS_ERR(node)) {
+        ret = PTR_ERR(node);
+        goto r_cdev;
     }
 
-    // Create a class for the UART device to make it available in /dev
-    uart_class = class_create(THIS_MODULE, "uart");
+    platform_set_drvdata(pdev, port);
+    dev_info(dev, "uart_tx%d at %u baud (UARTCLK %u Hz, %s)\n", port->minor, baud, rate,
+             port->irq < 0 ? "polling" : "IRQ");
+
+    return 0;
+
+r_cdev:
+    cdev_del(&port->cdev);
+r_irq:
+    writel(0, port->base + UART_IMSC); // Mask all UART interrupts; devm frees the IRQ
+    writel(0, port->base + UART_CR);   // Disable the UART again
+    ida_free(&uart_minors, port->minor);
+    return ret;
+}
+
+// Tear down one port (module unload only, see suppress_bind_attrs)
+static int uart_remove(struct platform_device *pdev) {
+    struct uart_dev *port = platform_get_drvdata(pdev);
+
+    device_destroy(uart_class, port->cdev.dev); // Destroy the device file
+    cdev_del(&port->cdev);                      // Unregister the character device
+    writel(0, port->base + UART_IMSC);          // Mask all UART interrupts; devm frees the IRQ
+    writel(0, port->base + UART_CR);            // Disable the UART before devm stops its clock
+    ida_free(&uart_minors, port->minor);
+    return 0;
+}
+
+// Only ports described for this driver, never a plain "arm,pl011"
+static const struct of_device_id uart_of_ids[] = {
+    { .compatible = "team17,pl011-tx" },
+    { }
+};
+MODULE_DEVICE_TABLE(of, uart_of_ids);
+
+static struct platform_driver uart_driver = {
+    .driver = {
+        .name = "uart_tx_data",
+        .of_match_table = uart_of_ids,
+        // Without bind/unbind in sysfs a port only goes away on rmmod, which open files prevent
+        .suppress_bind_attrs = true,
+    },
+    .probe = uart_probe,
+    .remove = uart_remove,
+};
+
+// Module initialization function
+static int __init uart_init(void) {
+    int ret;
+
+    printk(KERN_INFO "Initializing UART TX driver\n");
+
+    // Reserve the device numbers for all ports
+    ret = alloc_chrdev_region(&uart_devt, 0, UART_MAX_PORTS, "uart_tx");
+    if (ret) {
+        printk(KERN_ERR "Failed to register UART device numbers\n");
+        return ret;
+    }
+
+    // Create a class for the UART devices to make them available in /dev
+    uart_class = class_create(THIS_MODULE, "uart_tx");
     if (IS_ERR(uart_class)) {
-        unregister_chrdev(major, "uart"); // Unregister device on failure
-        iounmap(uart_base); // Unmap UART registers on failure
-        return PTR_ERR(uart_class); // Return error code for class creation
+        ret = PTR_ERR(uart_class); // Return error code for class creation
+        goto r_chrdev;
     }
 
-    // Create the device file in /dev
-    device_create(uart_class, NULL, MKDEV(major, 0), NULL, "uart");
-    printk(KERN_INFO "UART driver initialized successfully\n");
+    // Probe every port described for this driver
+    ret = platform_driver_register(&uart_driver);
+    if (ret)
+        goto r_class;
 
+    printk(KERN_INFO "UART TX driver initialized successfully\n");
     return 0; // Return 0 for successful initialization
+
+r_class:
+    class_destroy(uart_class);
+r_chrdev:
+    unregister_chrdev_region(uart_devt, UART_MAX_PORTS);
+    return ret;
 }
 
 // Module cleanup function
 static void __exit uart_exit(void) {
-    printk(KERN_INFO "Exiting UART driver\n");
+    printk(KERN_INFO "Exiting UART TX driver\n");
 
     // Clean up and unregister resources
-    device_destroy(uart_class, MKDEV(major, 0)); // Destroy the device file
+    platform_driver_unregister(&uart_driver); // Removes every port
     class_destroy(uart_class); // Destroy the class
-    unregister_chrdev(major, "uart"); // Unregister the character device
-    iounmap(uart_base); // Unmap UART registers from memory
+    unregister_chrdev_region(uart_devt, UART_MAX_PORTS); // Release the device numbers
 }
 
 // Specify the initialization and cleanup functions
@@ -164,4 +506,4 @@ module_exit(uart_exit);
 // Define module metadata
 MODULE_LICENSE("GPL");            // Set the module license to GPL
 MODULE_AUTHOR("TEAM 1 & 7");      // Author of the module
-MODULE_DESCRIPTION("UART driver for Raspberry Pi"); // Short description of the module
+MODULE_DESCRIPTION("UART TX driver for Raspberry Pi"); // Short description of the module